@@ -0,0 +1,88 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audioblockring.h"
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+void AudioBlock::reshape(int channels, int frames, bool isFloat)
+{
+    this->channels = channels;
+    this->frames = frames;
+    this->isFloat = isFloat;
+    const int size = channels * frames * sampleSize();
+    if (data.size() < size)
+        data.resize(size);
+}
+
+// Power of two, so that the slots stay in sequence when the indices wrap.
+static int roundUp(int blocks)
+{
+    int size = 1;
+    while (size < blocks)
+        size <<= 1;
+    return size;
+}
+
+AudioBlockRing::AudioBlockRing(int blocks)
+    : m_blocks(roundUp(blocks))
+    , m_readIndex(0)
+    , m_writeIndex(0)
+    , m_overruns(0)
+    , m_underruns(0)
+{
+}
+
+/*
+ * Each index is only written by its own side. Loading the other side's index
+ * with acquire and storing our own with release orders the block contents
+ * with the index, which is all the synchronization the ring needs.
+ */
+AudioBlock *AudioBlockRing::beginWrite()
+{
+    const int write = m_writeIndex;
+    const int read = m_readIndex.fetchAndAddAcquire(0);
+    if (uint(write) - uint(read) >= uint(blocks()))
+        return 0;
+    return &m_blocks[write & (blocks() - 1)];
+}
+
+bool AudioBlockRing::endWrite()
+{
+    const int write = m_writeIndex.fetchAndAddRelease(1);
+    return write == m_readIndex.fetchAndAddAcquire(0);
+}
+
+const AudioBlock *AudioBlockRing::beginRead()
+{
+    const int read = m_readIndex;
+    const int write = m_writeIndex.fetchAndAddAcquire(0);
+    if (read == write) {
+        m_underruns.ref();
+        return 0;
+    }
+    return &m_blocks.at(read & (blocks() - 1));
+}
+
+void AudioBlockRing::endRead()
+{
+    m_readIndex.fetchAndAddRelease(1);
+}
+
+}
+}
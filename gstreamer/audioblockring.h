@@ -0,0 +1,91 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_AUDIOBLOCKRING_H
+#define PHONON_GSTREAMER_AUDIOBLOCKRING_H
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Planar audio block, channels planes of frames samples each.
+ */
+struct AudioBlock
+{
+    AudioBlock() : channels(0), frames(0), isFloat(false) {}
+
+    int sampleSize() const { return isFloat ? int(sizeof(float)) : int(sizeof(qint16)); }
+    char *plane(int channel) { return data.data() + channel * frames * sampleSize(); }
+    const char *plane(int channel) const { return data.constData() + channel * frames * sampleSize(); }
+    /// Only reallocates if the block grows.
+    void reshape(int channels, int frames, bool isFloat);
+
+    int channels;
+    int frames;
+    bool isFloat;
+    QByteArray data;
+};
+
+/**
+ * Fixed number of AudioBlocks handed from one producer thread to one
+ * consumer thread without locks.
+ *
+ * Each side owns the blocks between its own index and the other side's, so
+ * the storage of a block is only ever touched by one thread at a time and
+ * is reused once it went around, a steady stream does not allocate.
+ */
+class AudioBlockRing
+{
+public:
+    /// blocks is rounded up to a power of two.
+    explicit AudioBlockRing(int blocks);
+
+    int blocks() const { return m_blocks.size(); }
+
+    /// Producer: the block to fill next, 0 if the consumer is behind.
+    AudioBlock *beginWrite();
+    /// Producer: publishes the block, returns true if the ring was empty.
+    bool endWrite();
+
+    /// Consumer: the oldest published block, 0 if there is none.
+    const AudioBlock *beginRead();
+    /// Consumer: hands the block back to the producer.
+    void endRead();
+
+    /// Blocks dropped because the ring was full.
+    int overruns() const { return m_overruns; }
+    /// Reads that found the ring empty.
+    int underruns() const { return m_underruns; }
+    void countOverrun() { m_overruns.ref(); }
+
+private:
+    QVector<AudioBlock> m_blocks;
+    // Wrapping counters, the slot is the counter modulo blocks()
+    QAtomicInt m_readIndex;
+    QAtomicInt m_writeIndex;
+    QAtomicInt m_overruns;
+    QAtomicInt m_underruns;
+};
+
+}
+}
+
+#endif // PHONON_GSTREAMER_AUDIOBLOCKRING_H
@@ -23,10 +23,14 @@
 */
 
 #include "audiodataoutput.h"
+#include "deinterleave.h"
+#include "debug.h"
 #include "gsthelper.h"
 #include "medianode.h"
 #include <QtCore/QVector>
 #include <QtCore/QMap>
+#include <QtCore/QVarLengthArray>
+#include <math.h>
 #include <phonon/audiooutput.h>
 
 #include <gst/gstghostpad.h>
@@ -40,7 +44,25 @@ namespace Gstreamer
 AudioDataOutput::AudioDataOutput(Backend *backend, QObject *parent)
     : QObject(parent)
     , MediaNode(backend, AudioSink)
+    , m_resample(0)
+    , m_format(Int16Format)
+    , m_fixedRate(0)
+    , m_sampleRate(0)
+    , m_dataSize(0)
+    , m_channels(0)
+    , m_floatBlocks(false)
+    , m_fill(0)
+    , m_ring(0)
+    , m_ringBlock(0)
+    , m_bucketSize(0)
+    , m_activeBucketSize(0)
+    , m_bucketFill(0)
+    , m_waveformFrames(0)
 {
+    qRegisterMetaType<FloatChannelData>("QMap<Phonon::AudioDataOutput::Channel,QVector<float> >");
+    qRegisterMetaType<QVector<WaveformBucket> >("QVector<Phonon::Gstreamer::WaveformBucket>");
+    qRegisterMetaType<WaveformData>("QMap<Phonon::AudioDataOutput::Channel,QVector<Phonon::Gstreamer::WaveformBucket> >");
+
     static int count = 0;
     m_name = "AudioDataOutput" + QString::number(count++);
 
@@ -49,22 +71,15 @@ AudioDataOutput::AudioDataOutput(Backend *backend, QObject *parent)
     gst_object_sink(GST_OBJECT(m_queue));
     GstElement* sink = gst_element_factory_make("fakesink", NULL);
     GstElement* queue = gst_element_factory_make("queue", NULL);
-    GstElement* convert = gst_element_factory_make("audioconvert", NULL);
+    m_convert = gst_element_factory_make("audioconvert", NULL);
+    m_capsFilter = gst_element_factory_make("capsfilter", NULL);
 
     g_signal_connect(sink, "handoff", G_CALLBACK(processBuffer), this);
     g_object_set(G_OBJECT(sink), "signal-handoffs", true, NULL);
 
-    //G_BYTE_ORDER is the host machine's endianess
-    GstCaps *caps = gst_caps_new_simple("audio/x-raw-int",
-                                        "endianess", G_TYPE_INT, G_BYTE_ORDER,
-                                        "width", G_TYPE_INT, 16,
-                                        "depth", G_TYPE_INT, 16,
-                                        NULL);
-
-    gst_bin_add_many(GST_BIN(m_queue), sink, convert, queue, NULL);
-    gst_element_link(queue, convert);
-    gst_element_link_filtered(convert, sink, caps);
-    gst_caps_unref(caps);
+    gst_bin_add_many(GST_BIN(m_queue), sink, m_convert, m_capsFilter, queue, NULL);
+    gst_element_link_many(queue, m_convert, m_capsFilter, sink, NULL);
+    updateCaps();
 
     GstPad *inputpad = gst_element_get_static_pad(queue, "sink");
     gst_element_add_pad(m_queue, gst_ghost_pad_new("sink", inputpad));
@@ -79,6 +94,7 @@ AudioDataOutput::~AudioDataOutput()
 {
     gst_element_set_state(m_queue, GST_STATE_NULL);
     gst_object_unref(m_queue);
+    delete m_ring;
 }
 
 void AudioDataOutput::setDataSize(int size)
@@ -93,112 +109,413 @@ int AudioDataOutput::dataSize() const
 
 int AudioDataOutput::sampleRate() const
 {
-    return 44100;
+    if (m_fixedRate > 0)
+        return m_fixedRate;
+    // Nothing negotiated yet, assume CD audio.
+    return m_sampleRate > 0 ? m_sampleRate : 44100;
 }
 
-inline void AudioDataOutput::convertAndEmit()
+int AudioDataOutput::sampleFormat() const
 {
-    QMap<Phonon::AudioDataOutput::Channel, QVector<qint16> > map;
+    return m_format;
+}
 
-    for (int i = 0 ; i < m_channels ; ++i) {
-        map.insert(static_cast<Phonon::AudioDataOutput::Channel>(i), m_channelBuffers[i]);
-        Q_ASSERT(i == 0 || m_channelBuffers[i - 1].size() == m_channelBuffers[i].size());
+void AudioDataOutput::setSampleFormat(int format)
+{
+    if (format != Int16Format && format != Float32Format) {
+        warning() << "Invalid sample format" << format;
+        return;
     }
-
-    emit dataReady(map);
+    if (format == m_format)
+        return;
+    m_format = static_cast<SampleFormat>(format);
+    updateCaps();
 }
 
-void AudioDataOutput::processBuffer(GstElement*, GstBuffer* buffer, GstPad*, gpointer gThat)
+int AudioDataOutput::fixedSampleRate() const
 {
-    // TODO emit endOfMedia
-    AudioDataOutput *that = static_cast<AudioDataOutput *>(gThat);
+    return m_fixedRate;
+}
 
-    // Copiend locally to avoid multithead problems
-    qint32 dataSize = that->m_dataSize;
-    if (dataSize == 0)
+void AudioDataOutput::setFixedSampleRate(int rate)
+{
+    if (rate < 0)
+        rate = 0;
+    if (rate == m_fixedRate)
         return;
+    m_fixedRate = rate;
+    if (!rate || m_resample) {
+        updateCaps();
+        return;
+    }
 
-    // determine the number of channels
-    GstStructure *structure = gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0);
-    gst_structure_get_int(structure, "channels", &that->m_channels);
+    // audioconvert cannot change the rate, so the new caps may only be set
+    // once the resampler is in place, see linkResample().
+    m_resample = gst_element_factory_make("audioresample", NULL);
+    if (!m_resample) {
+        warning() << "audioresample is not available, delivering the native rate";
+        m_fixedRate = 0;
+        return;
+    }
+    if (GST_STATE(m_queue) <= GST_STATE_READY) {
+        linkResample();
+        return;
+    }
+    GstPad *pad = gst_element_get_static_pad(m_convert, "src");
+    gst_pad_set_blocked_async(pad, TRUE, cb_resampleBlocked, this);
+    gst_object_unref(pad);
+}
 
-    // Let's get the buffers
-    gint16 *gstBufferData = reinterpret_cast<gint16 *>(GST_BUFFER_DATA(buffer));
-    guint gstBufferSize = GST_BUFFER_SIZE(buffer) / sizeof(gint16);
+int AudioDataOutput::blockBuffering() const
+{
+    return m_ring ? m_ring->blocks() : 0;
+}
 
-    if (gstBufferSize == 0) {
-        qWarning() << Q_FUNC_INFO << ": received a buffer of 0 size ... doing nothing";
+void AudioDataOutput::setBlockBuffering(int blocks)
+{
+    if (GST_STATE(m_queue) > GST_STATE_READY) {
+        warning() << "Block buffering can only be changed while stopped";
         return;
     }
+    delete m_ring;
+    m_ring = blocks > 0 ? new AudioBlockRing(blocks) : 0;
+    m_ringBlock = 0;
+    m_fill = 0;
+}
 
-    if ((gstBufferSize % that->m_channels) != 0) {
-        qWarning() << Q_FUNC_INFO << ": corrupted data";
+int AudioDataOutput::overruns() const
+{
+    return m_ring ? m_ring->overruns() : 0;
+}
+
+int AudioDataOutput::underruns() const
+{
+    return m_ring ? m_ring->underruns() : 0;
+}
+
+int AudioDataOutput::waveformBucketSize() const
+{
+    return m_bucketSize;
+}
+
+void AudioDataOutput::setWaveformBucketSize(int frames)
+{
+    m_bucketSize = qMax(0, frames);
+}
+
+template <typename T>
+bool AudioDataOutput::readBlock(QMap<Phonon::AudioDataOutput::Channel, QVector<T> > &data, bool isFloat)
+{
+    if (!m_ring)
+        return false;
+    const AudioBlock *block = m_ring->beginRead();
+    if (!block)
+        return false;
+
+    const bool match = block->isFloat == isFloat;
+    if (match) {
+        for (int i = 0; i < block->channels; ++i) {
+            QVector<T> &plane = data[static_cast<Phonon::AudioDataOutput::Channel>(i)];
+            plane.resize(block->frames);
+            qMemCopy(plane.data(), block->plane(i), block->frames * sizeof(T));
+        }
+    } else {
+        debug() << "Dropping a block in the other sample format";
+    }
+    m_ring->endRead();
+    return match;
+}
+
+bool AudioDataOutput::readBlock(QMap<Phonon::AudioDataOutput::Channel, QVector<qint16> > &data)
+{
+    return readBlock(data, false);
+}
+
+bool AudioDataOutput::readBlock(QMap<Phonon::AudioDataOutput::Channel, QVector<float> > &data)
+{
+    return readBlock(data, true);
+}
+
+void AudioDataOutput::cb_resampleBlocked(GstPad *pad, gboolean blocked, gpointer data)
+{
+    if (!blocked)
         return;
+    AudioDataOutput *that = static_cast<AudioDataOutput *>(data);
+    that->linkResample();
+    gst_pad_set_blocked_async(pad, FALSE, cb_resampleBlocked, data);
+}
+
+void AudioDataOutput::linkResample()
+{
+    gst_element_unlink(m_convert, m_capsFilter);
+    gst_bin_add(GST_BIN(m_queue), m_resample);
+    gst_element_link_many(m_convert, m_resample, m_capsFilter, NULL);
+    gst_element_sync_state_with_parent(m_resample);
+    updateCaps();
+}
+
+void AudioDataOutput::updateCaps()
+{
+    //G_BYTE_ORDER is the host machine's endianess
+    GstCaps *caps;
+    if (m_format == Float32Format) {
+        caps = gst_caps_new_simple("audio/x-raw-float",
+                                   "endianness", G_TYPE_INT, G_BYTE_ORDER,
+                                   "width", G_TYPE_INT, 32,
+                                   NULL);
+    } else {
+        caps = gst_caps_new_simple("audio/x-raw-int",
+                                   "endianness", G_TYPE_INT, G_BYTE_ORDER,
+                                   "width", G_TYPE_INT, 16,
+                                   "depth", G_TYPE_INT, 16,
+                                   "signed", G_TYPE_BOOLEAN, TRUE,
+                                   NULL);
+    }
+    // Until linkResample() ran audioconvert still feeds the capsfilter
+    // directly and cannot produce a fixed rate.
+    if (m_fixedRate > 0 && m_resample && GST_OBJECT_PARENT(m_resample))
+        gst_caps_set_simple(caps, "rate", G_TYPE_INT, m_fixedRate, NULL);
+    g_object_set(G_OBJECT(m_capsFilter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+}
+
+template <typename T>
+static QMap<Phonon::AudioDataOutput::Channel, QVector<T> > takeBlocks(QVector<QVector<T> > &blocks)
+{
+    QMap<Phonon::AudioDataOutput::Channel, QVector<T> > map;
+
+    for (int i = 0 ; i < blocks.size() ; ++i) {
+        map.insert(static_cast<Phonon::AudioDataOutput::Channel>(i), blocks[i]);
+        Q_ASSERT(i == 0 || blocks[i - 1].size() == blocks[i].size());
+    }
+    return map;
+}
+
+// Receivers may still hold the emitted blocks. Start over in fresh storage
+// rather than letting data() copy the old samples on detach.
+template <typename T>
+static void renewBlocks(QVector<QVector<T> > &blocks)
+{
+    for (int i = 0 ; i < blocks.size() ; ++i) {
+        if (!blocks[i].isDetached())
+            blocks[i] = QVector<T>(blocks[i].size());
     }
+}
+
+inline void AudioDataOutput::convertAndEmit(QVector<QVector<qint16> > &blocks)
+{
+    emit dataReady(takeBlocks(blocks));
+    renewBlocks(blocks);
+}
 
-    // I set the number of channels
-    if (that->m_channelBuffers.size() != that->m_channels)
-        that->m_channelBuffers.resize(that->m_channels);
+inline void AudioDataOutput::convertAndEmit(QVector<QVector<float> > &blocks)
+{
+    emit floatDataReady(takeBlocks(blocks));
+    renewBlocks(blocks);
+}
 
-    // check how many emits I will perform
-    int nBlockToSend = (that->m_pendingData.size() + gstBufferSize) / (dataSize * that->m_channels);
+/*
+ * Like deliver(), but into the blocks of the ring. Nothing is allocated or
+ * emitted per block, except for blockAvailable() when the consumer had
+ * drained the ring. If the ring is full the block is dropped.
+ */
+template <typename T>
+void AudioDataOutput::deliverToRing(const T *data, int channels, int frames, int dataSize)
+{
+    const bool isFloat = sizeof(T) == sizeof(float);
+    // The block size shrank under a partial block we are dropping.
+    if (m_fill >= dataSize)
+        m_fill = 0;
+    QVarLengthArray<T *, 8> planes(channels);
+    int frame = 0;
+    while (frame < frames) {
+        if (m_fill == 0) {
+            if (!m_ringBlock)
+                m_ringBlock = m_ring->beginWrite();
+            if (m_ringBlock)
+                m_ringBlock->reshape(channels, dataSize, isFloat);
+        } else if (m_ringBlock && (m_ringBlock->channels != channels || m_ringBlock->frames != dataSize)) {
+            m_ringBlock->reshape(channels, dataSize, isFloat);
+            m_fill = 0;
+        }
 
-    if (nBlockToSend == 0) { // add data to pending buffer
-        const int prevPendingSize = that->m_pendingData.size();
-        for (quint32 i = 0; i < gstBufferSize ; ++i) {
-#warning should be QBA, so we can work with append(buffer, size)
-            that->m_pendingData.append(gstBufferData[i]);
+        const int chunk = qMin(frames - frame, dataSize - m_fill);
+        if (m_ringBlock) {
+            for (int i = 0; i < channels; ++i)
+                planes[i] = reinterpret_cast<T *>(m_ringBlock->plane(i)) + m_fill;
+            deinterleave(data + frame * channels, planes.constData(), channels, chunk);
         }
-        Q_ASSERT(prevPendingSize + gstBufferSize == that->m_pendingData.size());
+        m_fill += chunk;
+        frame += chunk;
+
+        if (m_fill == dataSize) {
+            if (!m_ringBlock)
+                m_ring->countOverrun();
+            else if (m_ring->endWrite())
+                emit blockAvailable();
+            m_ringBlock = 0;
+            m_fill = 0;
+        }
+    }
+}
+
+/*
+ * Deinterleaves straight into the blocks, emitting each one as it fills up.
+ */
+template <typename T>
+void AudioDataOutput::deliver(const T *data, int channels, int frames, int dataSize, QVector<QVector<T> > &blocks)
+{
+    if (m_ring) {
+        deliverToRing(data, channels, frames, dataSize);
         return;
     }
 
-    // SENDING DATA
+    // A new layout or block size invalidates the partially filled block.
+    if (blocks.size() != channels || blocks[0].size() != dataSize) {
+        blocks.resize(channels);
+        for (int i = 0; i < channels; ++i)
+            blocks[i].resize(dataSize);
+        m_fill = 0;
+    }
+
+    QVarLengthArray<T *, 8> planes(channels);
+    int frame = 0;
+    while (frame < frames) {
+        const int chunk = qMin(frames - frame, dataSize - m_fill);
+        for (int i = 0; i < channels; ++i)
+            planes[i] = blocks[i].data() + m_fill;
+        deinterleave(data + frame * channels, planes.constData(), channels, chunk);
+        m_fill += chunk;
+        frame += chunk;
+
+        if (m_fill == dataSize) {
+            convertAndEmit(blocks);
+            m_fill = 0;
+        }
+    }
+}
+
+void AudioDataOutput::resetWaveform(int channels, int bucketSize)
+{
+    m_activeBucketSize = bucketSize;
+    m_bucketMin.fill(0, channels);
+    m_bucketMax.fill(0, channels);
+    m_bucketSquares.fill(0, channels);
+    m_bucketFill = 0;
+    m_waveform.resize(channels);
+    for (int i = 0; i < channels; ++i)
+        m_waveform[i].resize(0);
+    m_waveformFrames = 0;
+}
 
-    // 1) I empty the stored data
-    if (that->m_pendingData.size() != 0) {
-        // Since pendingData is a concatenation of buffers it must share its
-        // attribute of being a multiple of channelCount
-        Q_ASSERT((that->m_pendingData.size() % that->m_channels) == 0);
-        for (int i = 0; i < that->m_pendingData.size(); i += that->m_channels) {
-            for (int j = 0; j < that->m_channels; ++j) {
-                that->m_channelBuffers[j].append(that->m_pendingData[i+j]);
+/*
+ * Reduces interleaved samples to min/max/RMS buckets per channel, emitting
+ * the buckets of every dataSize frames. Works on the interleaved data
+ * directly, the samples themselves never leave the streaming thread.
+ */
+template <typename T>
+void AudioDataOutput::reduce(const T *data, int channels, int frames, int dataSize, float scale)
+{
+    const int bucketSize = m_bucketSize;
+    if (bucketSize != m_activeBucketSize || m_waveform.size() != channels)
+        resetWaveform(channels, bucketSize);
+
+    float *minimum = m_bucketMin.data();
+    float *maximum = m_bucketMax.data();
+    float *squares = m_bucketSquares.data();
+    for (int i = 0; i < frames; ++i) {
+        for (int c = 0; c < channels; ++c) {
+            const float sample = data[c] * scale;
+            if (m_bucketFill == 0) {
+                minimum[c] = sample;
+                maximum[c] = sample;
+                squares[c] = 0;
+            } else {
+                minimum[c] = qMin(minimum[c], sample);
+                maximum[c] = qMax(maximum[c], sample);
             }
+            squares[c] += sample * sample;
         }
+        data += channels;
 
-        if (that->m_pendingData.capacity() != dataSize)
-            that->m_pendingData.reserve(dataSize);
+        if (++m_bucketFill == bucketSize) {
+            for (int c = 0; c < channels; ++c) {
+                const WaveformBucket bucket = { minimum[c], maximum[c], sqrtf(squares[c] / bucketSize) };
+                m_waveform[c].append(bucket);
+            }
+            m_bucketFill = 0;
+        }
 
-        that->m_pendingData.resize(0);
+        if (++m_waveformFrames >= dataSize) {
+            QMap<Phonon::AudioDataOutput::Channel, QVector<WaveformBucket> > map;
+            for (int c = 0; c < channels; ++c) {
+                map.insert(static_cast<Phonon::AudioDataOutput::Channel>(c), m_waveform[c]);
+                m_waveform[c].resize(0);
+            }
+            emit waveformReady(map);
+            m_waveformFrames = 0;
+        }
     }
+}
+
+void AudioDataOutput::processBuffer(GstElement*, GstBuffer* buffer, GstPad*, gpointer gThat)
+{
+    // TODO emit endOfMedia
+    AudioDataOutput *that = static_cast<AudioDataOutput *>(gThat);
 
-    // 2) I fill with fresh data and send
-    for (int i = 0 ; i < that->m_channels ; ++i)
-    {
-        if (that->m_channelBuffers[i].capacity() != dataSize)
-            that->m_channelBuffers.reserve(dataSize);
+    // Copiend locally to avoid multithead problems
+    qint32 dataSize = that->m_dataSize;
+    if (dataSize == 0)
+        return;
+
+    // determine the number of channels, the rate and the sample format
+    GstStructure *structure = gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0);
+    int channels = 0;
+    gst_structure_get_int(structure, "channels", &channels);
+    gst_structure_get_int(structure, "rate", &that->m_sampleRate);
+    if (channels <= 0) {
+        qWarning() << Q_FUNC_INFO << ": no channel count in the caps";
+        return;
     }
+    const bool isFloat = gst_structure_has_name(structure, "audio/x-raw-float");
+    const int sampleSize = isFloat ? sizeof(float) : sizeof(gint16);
 
-    quint32 bufferPosition = 0;
-    for (int i = 0 ; i < nBlockToSend ; ++i) {
-        for ( ; (that->m_channelBuffers[0].size() < dataSize) && (bufferPosition < gstBufferSize) ; bufferPosition += that->m_channels ) {
-            for (int j = 0 ; j < that->m_channels ; ++j) {
-                that->m_channelBuffers[j].append(gstBufferData[bufferPosition+j]);
-            }
-        }
+    const guint gstBufferSize = GST_BUFFER_SIZE(buffer) / sampleSize;
+    if (gstBufferSize == 0) {
+        qWarning() << Q_FUNC_INFO << ": received a buffer of 0 size ... doing nothing";
+        return;
+    }
 
-        that->convertAndEmit();
+    if ((gstBufferSize % channels) != 0) {
+        qWarning() << Q_FUNC_INFO << ": corrupted data";
+        return;
+    }
 
-        for (int j = 0 ; j < that->m_channels ; ++j) {
-            // QVector::resize doesn't reallocate the buffer
-            that->m_channelBuffers[j].resize(0);
+    // Switching formats drops the partial block of the old one.
+    if (channels != that->m_channels || isFloat != that->m_floatBlocks) {
+        that->m_channels = channels;
+        that->m_floatBlocks = isFloat;
+        that->m_fill = 0;
+    }
+
+    const int frames = gstBufferSize / channels;
+    if (that->m_bucketSize > 0) {
+        if (isFloat) {
+            that->reduce(reinterpret_cast<const float *>(GST_BUFFER_DATA(buffer)),
+                         channels, frames, dataSize, 1.0f);
+        } else {
+            that->reduce(reinterpret_cast<const qint16 *>(GST_BUFFER_DATA(buffer)),
+                         channels, frames, dataSize, 1.0f / 32768);
         }
+        return;
     }
 
-    // 3) I store the rest of data
-    while (bufferPosition < gstBufferSize) {
-        that->m_pendingData.append(gstBufferData[bufferPosition]);
-        ++bufferPosition;
+    if (isFloat) {
+        that->deliver(reinterpret_cast<const float *>(GST_BUFFER_DATA(buffer)),
+                      channels, frames, dataSize, that->m_floatBuffers);
+    } else {
+        that->deliver(reinterpret_cast<const qint16 *>(GST_BUFFER_DATA(buffer)),
+                      channels, frames, dataSize, that->m_channelBuffers);
     }
 }
 
@@ -25,14 +25,26 @@
 #ifndef Phonon_GSTREAMER_AUDIODATAOUTPUT_H
 #define Phonon_GSTREAMER_AUDIODATAOUTPUT_H
 
+#include "audioblockring.h"
 #include "medianode.h"
 #include <phonon/audiodataoutput.h>
 #include <phonon/audiodataoutputinterface.h>
+#include <QtCore/QMetaType>
 
 namespace Phonon
 {
 namespace Gstreamer
 {
+/**
+ * Reduction of bucketSize frames of one channel, samples scaled to [-1, 1].
+ */
+struct WaveformBucket
+{
+    float min;
+    float max;
+    float rms;
+};
+
 /**
  * \author Martin Sandsmark <sandsmark@samfundet.no>
  */
@@ -44,14 +56,37 @@ class AudioDataOutput : public QObject,
     Q_INTERFACES(Phonon::AudioDataOutputInterface Phonon::Gstreamer::MediaNode)
 
 public:
+    enum SampleFormat {
+        Int16Format,    // dataReady(), what the frontend expects
+        Float32Format   // floatDataReady(), samples in [-1, 1]
+    };
+
     AudioDataOutput(Backend *backend, QObject *parent);
     ~AudioDataOutput();
 
 public Q_SLOTS:
     int dataSize() const;
+    // The negotiated rate, or the fixed one if setFixedSampleRate() was used.
     int sampleRate() const;
     void setDataSize(int size);
 
+    // Backend specific, not part of AudioDataOutputInterface
+    int sampleFormat() const;
+    void setSampleFormat(int format);
+    int fixedSampleRate() const;
+    // Resamples to rate, 0 delivers the native rate of the stream.
+    void setFixedSampleRate(int rate);
+    // With blocks > 0, blocks are queued for readBlock() instead of being
+    // emitted. Only takes effect while stopped.
+    int blockBuffering() const;
+    void setBlockBuffering(int blocks);
+    int overruns() const;
+    int underruns() const;
+    // With frames > 0, every block is reduced to buckets of that many frames
+    // and delivered through waveformReady() instead of the samples.
+    int waveformBucketSize() const;
+    void setWaveformBucketSize(int frames);
+
 public:
     /// callback function for handling new audio data
     static void processBuffer(GstElement*, GstBuffer*, GstPad*, gpointer);
@@ -61,22 +96,75 @@ public:
 
     GstElement *audioElement() { return m_queue; }
 
+    // Copies the oldest queued block into data, reusing its vectors. Returns
+    // false if there is none, or if it has the other sample format.
+    bool readBlock(QMap<Phonon::AudioDataOutput::Channel, QVector<qint16> > &data);
+    bool readBlock(QMap<Phonon::AudioDataOutput::Channel, QVector<float> > &data);
+
 signals:
     void dataReady(const QMap<Phonon::AudioDataOutput::Channel, QVector<qint16> > &data);
+    void floatDataReady(const QMap<Phonon::AudioDataOutput::Channel, QVector<float> > &data);
     void endOfMedia(int remainingSamples);
+    // The block queue is no longer empty, see setBlockBuffering().
+    void blockAvailable();
+    // dataSize() / waveformBucketSize() buckets per channel
+    void waveformReady(const QMap<Phonon::AudioDataOutput::Channel, QVector<Phonon::Gstreamer::WaveformBucket> > &data);
 
 private:
-    void convertAndEmit();
+    template <typename T>
+    void deliver(const T *data, int channels, int frames, int dataSize, QVector<QVector<T> > &blocks);
+    template <typename T>
+    void deliverToRing(const T *data, int channels, int frames, int dataSize);
+    template <typename T>
+    bool readBlock(QMap<Phonon::AudioDataOutput::Channel, QVector<T> > &data, bool isFloat);
+    template <typename T>
+    void reduce(const T *data, int channels, int frames, int dataSize, float scale);
+    void resetWaveform(int channels, int bucketSize);
+    void convertAndEmit(QVector<QVector<qint16> > &blocks);
+    void convertAndEmit(QVector<QVector<float> > &blocks);
+    void updateCaps();
+    void linkResample();
+    static void cb_resampleBlocked(GstPad *pad, gboolean blocked, gpointer data);
 
     GstElement *m_queue;
+    GstElement *m_convert;
+    // Only inserted once a fixed rate is asked for
+    GstElement *m_resample;
+    GstElement *m_capsFilter;
+    SampleFormat m_format;
+    int m_fixedRate;
+    int m_sampleRate;
     Phonon::AudioDataOutput *m_frontend;
-    QVector<qint16> m_pendingData;
     qint32 m_dataSize;
     int m_channels;
+    // One block of dataSize samples per channel, filled up to m_fill
     QVector<QVector<qint16> > m_channelBuffers;
+    QVector<QVector<float> > m_floatBuffers;
+    bool m_floatBlocks;
+    int m_fill;
+    AudioBlockRing *m_ring;
+    // Block of the ring being filled, 0 while the ring is full
+    AudioBlock *m_ringBlock;
+    int m_bucketSize;
+    // Waveform state of the streaming thread, see reduce()
+    int m_activeBucketSize;
+    QVector<float> m_bucketMin;
+    QVector<float> m_bucketMax;
+    QVector<float> m_bucketSquares;
+    int m_bucketFill;
+    QVector<QVector<WaveformBucket> > m_waveform;
+    int m_waveformFrames;
 };
+
+// Signal payloads, emitted from the streaming thread
+typedef QMap<Phonon::AudioDataOutput::Channel, QVector<float> > FloatChannelData;
+typedef QMap<Phonon::AudioDataOutput::Channel, QVector<WaveformBucket> > WaveformData;
 } // namespace Gstreamer
 } // namespace Phonon
 
+Q_DECLARE_METATYPE(Phonon::Gstreamer::FloatChannelData)
+Q_DECLARE_METATYPE(QVector<Phonon::Gstreamer::WaveformBucket>)
+Q_DECLARE_METATYPE(Phonon::Gstreamer::WaveformData)
+
 // vim: sw=4 ts=4 tw=80
 #endif // Phonon_GSTREAMER_AUDIODATAOUTPUT_H
@@ -24,12 +24,14 @@
 #include "audioeffect.h"
 #include "debug.h"
 #include "mediaobject.h"
+#include "pipeline.h"
 #ifndef PHONON_NO_GRAPHICSVIEW
 #include "videographicsobject.h"
 #endif
 #include "videowidget.h"
 #include "devicemanager.h"
 #include "effectmanager.h"
+#include "visualization.h"
 #include "volumefadereffect.h"
 #include <gst/interfaces/propertyprobe.h>
 #include <phonon/pulsesupport.h>
@@ -42,6 +44,10 @@
 
 #include <cstring>
 
+// Number of pipelines of destroyed MediaObjects kept around for new ones, can
+// be overridden through PHONON_GST_PIPELINE_POOL (0 disables the pool).
+#define DEFAULT_PIPELINE_POOL 1
+
 Q_EXPORT_PLUGIN2(phonon_gstreamer, Phonon::Gstreamer::Backend)
 
 namespace Phonon
@@ -56,6 +62,10 @@ Backend::Backend(QObject *parent, const QVariantList &)
         , m_deviceManager(0)
         , m_effectManager(0)
         , m_isValid(false)
+        , m_pipelinePoolSize(qgetenv("PHONON_GST_PIPELINE_POOL").isEmpty()
+                             ? DEFAULT_PIPELINE_POOL : qgetenv("PHONON_GST_PIPELINE_POOL").toInt())
+        , m_pipelinePoolHits(0)
+        , m_pipelinePoolMisses(0)
 {
     // Initialise PulseAudio support
     PulseSupport *pulse = PulseSupport::getInstance();
@@ -118,6 +128,8 @@ Backend::Backend(QObject *parent, const QVariantList &)
 
 Backend::~Backend()
 {
+    qDeleteAll(m_pipelinePool);
+    m_pipelinePool.clear();
     if (GlobalSubtitles::self)
         delete GlobalSubtitles::self;
     if (GlobalAudioChannels::self)
@@ -174,13 +186,46 @@ QObject *Backend::createObject(BackendInterface::Class c, QObject *parent, const
         return new VolumeFaderEffect(this, parent);
 #endif // QT_NO_PHONON_VOLUMEFADEREFFECT
 
-    case VisualizationClass:  //Fall through
+    case VisualizationClass:
+        return new Visualization(this, parent);
+
     default:
         warning() << "Backend class" << c << "is not supported by Phonon GST :(";
     }
     return 0;
 }
 
+/*
+ * Hands out a pipeline for a new MediaObject. Building a playbin2 with its
+ * sink graphs is not free, so pipelines of destroyed MediaObjects are reset
+ * and kept for the next one. Nothing is built ahead of time, an application
+ * that never destroys a MediaObject does not pay for idle pipelines.
+ */
+Pipeline *Backend::acquirePipeline(QObject *parent)
+{
+    Pipeline *pipeline = 0;
+    if (!m_pipelinePool.isEmpty()) {
+        pipeline = m_pipelinePool.takeLast();
+        pipeline->setParent(parent);
+        ++m_pipelinePoolHits;
+    } else {
+        pipeline = new Pipeline(parent);
+        ++m_pipelinePoolMisses;
+    }
+    return pipeline;
+}
+
+void Backend::releasePipeline(Pipeline *pipeline)
+{
+    if (m_pipelinePool.size() >= m_pipelinePoolSize) {
+        delete pipeline;
+        return;
+    }
+    pipeline->reset();
+    pipeline->setParent(this);
+    m_pipelinePool.append(pipeline);
+}
+
 // Returns true if all dependencies are met
 // and gstreamer is usable, otherwise false
 bool Backend::isValid() const
@@ -33,6 +33,7 @@ class AudioOutput;
 class DeviceManager;
 class EffectManager;
 class MediaObject;
+class Pipeline;
 
 class Backend : public QObject, public BackendInterface
 {
@@ -61,6 +62,12 @@ public:
     // 'retry' indicates that we'd like to check the deps after a registry rebuild
     bool checkDependencies(bool retry = false) const;
 
+    // Pool of ready-made pipelines for MediaObjects, see acquirePipeline()
+    Pipeline *acquirePipeline(QObject *parent);
+    void releasePipeline(Pipeline *pipeline);
+    int pipelinePoolHits() const { return m_pipelinePoolHits; }
+    int pipelinePoolMisses() const { return m_pipelinePoolMisses; }
+
 Q_SIGNALS:
     void objectDescriptionChanged(ObjectDescriptionType);
 
@@ -71,6 +78,11 @@ private:
     DeviceManager *m_deviceManager;
     EffectManager *m_effectManager;
     bool m_isValid;
+
+    QList<Pipeline*> m_pipelinePool;
+    int m_pipelinePoolSize;
+    int m_pipelinePoolHits;
+    int m_pipelinePoolMisses;
 };
 
 }
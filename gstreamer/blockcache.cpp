@@ -0,0 +1,123 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "blockcache.h"
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+BlockCache::BlockCache(int blockSize, int maxSize)
+    : m_blockSize(blockSize)
+    , m_blocks(maxSize)
+    , m_streamSize(0)
+    , m_pendingIndex(0)
+    , m_pendingSize(-1)
+{
+}
+
+void BlockCache::write(quint64 pos, const char *data, int length)
+{
+    if (!isEnabled())
+        return;
+
+    while (length > 0) {
+        const quint64 index = pos / m_blockSize;
+        const int offset = pos % m_blockSize;
+
+        // Only blocks we saw from their very first byte can be completed.
+        if (m_pendingSize < 0 || index != m_pendingIndex || offset != m_pendingSize) {
+            if (offset != 0 || m_blocks.contains(index)) {
+                const int skip = qMin(length, m_blockSize - offset);
+                pos += skip;
+                data += skip;
+                length -= skip;
+                m_pendingSize = -1;
+                continue;
+            }
+            m_pending.resize(m_blockSize);
+            m_pendingIndex = index;
+            m_pendingSize = 0;
+        }
+
+        const int chunk = qMin(length, m_blockSize - m_pendingSize);
+        qMemCopy(m_pending.data() + m_pendingSize, data, chunk);
+        m_pendingSize += chunk;
+        pos += chunk;
+        data += chunk;
+        length -= chunk;
+
+        const bool atEnd = m_streamSize > 0
+                && m_pendingIndex * m_blockSize + m_pendingSize >= m_streamSize;
+        if (m_pendingSize == m_blockSize || atEnd) {
+            // The last block is stored with its real length.
+            m_pending.resize(m_pendingSize);
+            m_blocks.insert(m_pendingIndex, new QByteArray(m_pending), m_pendingSize);
+            // Hand the storage over to the cache rather than detaching later.
+            m_pending.clear();
+            m_pendingSize = -1;
+        }
+    }
+}
+
+bool BlockCache::read(quint64 pos, int length, char *data)
+{
+    if (!isEnabled() || length <= 0)
+        return false;
+    // Only the last block may be short, this keeps the copy within it.
+    if (m_streamSize > 0 && pos + length > m_streamSize)
+        return false;
+
+    // Check everything is there first, so that a miss does not reorder the LRU.
+    const quint64 first = pos / m_blockSize;
+    const quint64 last = (pos + length - 1) / m_blockSize;
+    for (quint64 index = first; index <= last; ++index) {
+        if (!m_blocks.contains(index))
+            return false;
+    }
+
+    while (length > 0) {
+        const QByteArray *block = m_blocks.object(pos / m_blockSize);
+        const int offset = pos % m_blockSize;
+        const int chunk = qMin(length, m_blockSize - offset);
+        qMemCopy(data, block->constData() + offset, chunk);
+        pos += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+void BlockCache::setStreamSize(quint64 size)
+{
+    if (size == m_streamSize)
+        return;
+    // A short block cached for the old end is not complete anymore.
+    if (m_streamSize % m_blockSize)
+        m_blocks.remove(m_streamSize / m_blockSize);
+    m_streamSize = size;
+    m_pendingSize = -1;
+}
+
+void BlockCache::clear()
+{
+    m_blocks.clear();
+    m_streamSize = 0;
+    m_pendingSize = -1;
+}
+
+}
+}
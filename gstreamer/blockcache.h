@@ -0,0 +1,66 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_BLOCKCACHE_H
+#define PHONON_GSTREAMER_BLOCKCACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * LRU cache of fixed-size, aligned blocks of a seekable byte stream.
+ *
+ * Data is fed in stream order through write(); only complete blocks end up
+ * in the cache, a partial block at the start of a run (e.g. right after a
+ * seek) is skipped. Once the stream size is known, the short block at the
+ * end of the stream counts as complete. The cache is not thread safe.
+ */
+class BlockCache
+{
+public:
+    BlockCache(int blockSize, int maxSize);
+
+    int blockSize() const { return m_blockSize; }
+    int maxSize() const { return m_blocks.maxCost(); }
+    bool isEnabled() const { return maxSize() >= m_blockSize; }
+
+    /// Feeds length bytes that start at stream offset pos.
+    void write(quint64 pos, const char *data, int length);
+    /// Copies [pos, pos + length) into data if it is entirely cached.
+    bool read(quint64 pos, int length, char *data);
+    /// Total stream length, 0 if unknown.
+    void setStreamSize(quint64 size);
+
+    void clear();
+
+private:
+    int m_blockSize;
+    QCache<quint64, QByteArray> m_blocks;
+    quint64 m_streamSize;
+    // Block currently being assembled from write()
+    QByteArray m_pending;
+    quint64 m_pendingIndex;
+    int m_pendingSize;
+};
+
+}
+}
+
+#endif // PHONON_GSTREAMER_BLOCKCACHE_H
@@ -0,0 +1,255 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "deinterleave.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PHONON_GST_NEON
+#endif
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/*
+ * The SIMD kernels handle blocks of 8 frames (4 for float) and return how
+ * many frames they did, the scalar loop takes care of the rest.
+ */
+template <typename T, int Channels>
+static inline void deinterleaveScalar(const T *in, T *const *out, int first, int frames)
+{
+    in += first * Channels;
+    for (int i = first; i < frames; ++i) {
+        for (int c = 0; c < Channels; ++c)
+            out[c][i] = in[c];
+        in += Channels;
+    }
+}
+
+#if defined(__SSE2__)
+
+static int deinterleave2(const qint16 *in, qint16 *const *out, int frames)
+{
+    const int blocks = frames & ~7;
+    for (int i = 0; i < blocks; i += 8) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i + 8));
+        // Sign extend the even and odd samples to 32 bit and pack them back.
+        const __m128i left = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                                             _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        const __m128i right = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[0] + i), left);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[1] + i), right);
+    }
+    return blocks;
+}
+
+static int deinterleave6(const qint16 *, qint16 *const *, int)
+{
+    // Six lanes do not map onto SSE2 shuffles without a lot of juggling,
+    // the unrolled scalar loop is about as fast.
+    return 0;
+}
+
+static int deinterleave8(const qint16 *in, qint16 *const *out, int frames)
+{
+    const int blocks = frames & ~7;
+    for (int i = 0; i < blocks; i += 8) {
+        const __m128i *frame = reinterpret_cast<const __m128i *>(in + 8 * i);
+        // 8x8 transpose of 16 bit samples
+        const __m128i r0 = _mm_loadu_si128(frame);
+        const __m128i r1 = _mm_loadu_si128(frame + 1);
+        const __m128i r2 = _mm_loadu_si128(frame + 2);
+        const __m128i r3 = _mm_loadu_si128(frame + 3);
+        const __m128i r4 = _mm_loadu_si128(frame + 4);
+        const __m128i r5 = _mm_loadu_si128(frame + 5);
+        const __m128i r6 = _mm_loadu_si128(frame + 6);
+        const __m128i r7 = _mm_loadu_si128(frame + 7);
+
+        const __m128i t0 = _mm_unpacklo_epi16(r0, r1);
+        const __m128i t1 = _mm_unpackhi_epi16(r0, r1);
+        const __m128i t2 = _mm_unpacklo_epi16(r2, r3);
+        const __m128i t3 = _mm_unpackhi_epi16(r2, r3);
+        const __m128i t4 = _mm_unpacklo_epi16(r4, r5);
+        const __m128i t5 = _mm_unpackhi_epi16(r4, r5);
+        const __m128i t6 = _mm_unpacklo_epi16(r6, r7);
+        const __m128i t7 = _mm_unpackhi_epi16(r6, r7);
+
+        const __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+        const __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+        const __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+        const __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+        const __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+        const __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+        const __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+        const __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[0] + i), _mm_unpacklo_epi64(u0, u4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[1] + i), _mm_unpackhi_epi64(u0, u4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[2] + i), _mm_unpacklo_epi64(u1, u5));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[3] + i), _mm_unpackhi_epi64(u1, u5));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[4] + i), _mm_unpacklo_epi64(u2, u6));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[5] + i), _mm_unpackhi_epi64(u2, u6));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[6] + i), _mm_unpacklo_epi64(u3, u7));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out[7] + i), _mm_unpackhi_epi64(u3, u7));
+    }
+    return blocks;
+}
+
+static int deinterleave2(const float *in, float *const *out, int frames)
+{
+    const int blocks = frames & ~3;
+    for (int i = 0; i < blocks; i += 4) {
+        const __m128 a = _mm_loadu_ps(in + 2 * i);
+        const __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+        _mm_storeu_ps(out[0] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(out[1] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    return blocks;
+}
+
+#elif defined(PHONON_GST_NEON)
+
+static int deinterleave2(const qint16 *in, qint16 *const *out, int frames)
+{
+    const int blocks = frames & ~7;
+    for (int i = 0; i < blocks; i += 8) {
+        const int16x8x2_t v = vld2q_s16(in + 2 * i);
+        vst1q_s16(out[0] + i, v.val[0]);
+        vst1q_s16(out[1] + i, v.val[1]);
+    }
+    return blocks;
+}
+
+/*
+ * Loading channel pairs as 32 bit lanes splits a frame into Channels / 2
+ * vectors, unzipping two of them separates the even and odd channel.
+ */
+static int deinterleave6(const qint16 *in, qint16 *const *out, int frames)
+{
+    const int blocks = frames & ~7;
+    for (int i = 0; i < blocks; i += 8) {
+        const int32x4x3_t a = vld3q_s32(reinterpret_cast<const int32_t *>(in + 6 * i));
+        const int32x4x3_t b = vld3q_s32(reinterpret_cast<const int32_t *>(in + 6 * i + 24));
+        for (int pair = 0; pair < 3; ++pair) {
+            const int16x8x2_t v = vuzpq_s16(vreinterpretq_s16_s32(a.val[pair]),
+                                            vreinterpretq_s16_s32(b.val[pair]));
+            vst1q_s16(out[2 * pair] + i, v.val[0]);
+            vst1q_s16(out[2 * pair + 1] + i, v.val[1]);
+        }
+    }
+    return blocks;
+}
+
+static int deinterleave8(const qint16 *in, qint16 *const *out, int frames)
+{
+    const int blocks = frames & ~7;
+    for (int i = 0; i < blocks; i += 8) {
+        const int32x4x4_t a = vld4q_s32(reinterpret_cast<const int32_t *>(in + 8 * i));
+        const int32x4x4_t b = vld4q_s32(reinterpret_cast<const int32_t *>(in + 8 * i + 32));
+        for (int pair = 0; pair < 4; ++pair) {
+            const int16x8x2_t v = vuzpq_s16(vreinterpretq_s16_s32(a.val[pair]),
+                                            vreinterpretq_s16_s32(b.val[pair]));
+            vst1q_s16(out[2 * pair] + i, v.val[0]);
+            vst1q_s16(out[2 * pair + 1] + i, v.val[1]);
+        }
+    }
+    return blocks;
+}
+
+static int deinterleave2(const float *in, float *const *out, int frames)
+{
+    const int blocks = frames & ~3;
+    for (int i = 0; i < blocks; i += 4) {
+        const float32x4x2_t v = vld2q_f32(in + 2 * i);
+        vst1q_f32(out[0] + i, v.val[0]);
+        vst1q_f32(out[1] + i, v.val[1]);
+    }
+    return blocks;
+}
+
+#else
+
+static int deinterleave2(const qint16 *, qint16 *const *, int) { return 0; }
+static int deinterleave6(const qint16 *, qint16 *const *, int) { return 0; }
+static int deinterleave8(const qint16 *, qint16 *const *, int) { return 0; }
+static int deinterleave2(const float *, float *const *, int) { return 0; }
+
+#endif
+
+template <typename T>
+static void deinterleaveGeneric(const T *in, T *const *out, int channels, int frames)
+{
+    for (int i = 0; i < frames; ++i) {
+        for (int c = 0; c < channels; ++c)
+            out[c][i] = in[c];
+        in += channels;
+    }
+}
+
+void deinterleave(const qint16 *in, qint16 *const *out, int channels, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    switch (channels) {
+    case 1:
+        qMemCopy(out[0], in, frames * sizeof(qint16));
+        break;
+    case 2:
+        deinterleaveScalar<qint16, 2>(in, out, deinterleave2(in, out, frames), frames);
+        break;
+    case 6:
+        deinterleaveScalar<qint16, 6>(in, out, deinterleave6(in, out, frames), frames);
+        break;
+    case 8:
+        deinterleaveScalar<qint16, 8>(in, out, deinterleave8(in, out, frames), frames);
+        break;
+    default:
+        deinterleaveGeneric(in, out, channels, frames);
+        break;
+    }
+}
+
+void deinterleave(const float *in, float *const *out, int channels, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    switch (channels) {
+    case 1:
+        qMemCopy(out[0], in, frames * sizeof(float));
+        break;
+    case 2:
+        deinterleaveScalar<float, 2>(in, out, deinterleave2(in, out, frames), frames);
+        break;
+    case 6:
+        deinterleaveScalar<float, 6>(in, out, 0, frames);
+        break;
+    case 8:
+        deinterleaveScalar<float, 8>(in, out, 0, frames);
+        break;
+    default:
+        deinterleaveGeneric(in, out, channels, frames);
+        break;
+    }
+}
+
+}
+}
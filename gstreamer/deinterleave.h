@@ -0,0 +1,40 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_DEINTERLEAVE_H
+#define PHONON_GSTREAMER_DEINTERLEAVE_H
+
+#include <QtCore/QtGlobal>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Splits frames of interleaved PCM into one plane per channel.
+ *
+ * in holds frames * channels samples, out[c] must have room for frames
+ * samples. Mono, stereo, 5.1 and 7.1 have dedicated kernels (SSE2 or NEON
+ * where the target has them), other layouts take a generic loop. Float
+ * samples only have a vector kernel for stereo.
+ */
+void deinterleave(const qint16 *in, qint16 *const *out, int channels, int frames);
+void deinterleave(const float *in, float *const *out, int channels, int frames);
+
+}
+}
+
+#endif // PHONON_GSTREAMER_DEINTERLEAVE_H
@@ -0,0 +1,120 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "downloadcache.h"
+
+#include "debug.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QFile>
+#include <QtGui/QDesktopServices>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+// Default for PHONON_GST_DOWNLOAD_CACHE_SIZE, in MiB. Keeping copies of what
+// was played is up to the user, so the cache is off unless asked for.
+#define DEFAULT_DOWNLOAD_CACHE_SIZE 0
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+DownloadCache::DownloadCache()
+    : m_maxSize(qint64(DEFAULT_DOWNLOAD_CACHE_SIZE) * 1024 * 1024)
+{
+    QByteArray size = qgetenv("PHONON_GST_DOWNLOAD_CACHE_SIZE");
+    if (!size.isEmpty())
+        m_maxSize = size.toLongLong() * 1024 * 1024;
+
+    QString dir = QString::fromLocal8Bit(qgetenv("PHONON_GST_DOWNLOAD_CACHE_DIR"));
+    if (dir.isEmpty())
+        dir = QDesktopServices::storageLocation(QDesktopServices::CacheLocation) + QLatin1String("/phonon-gstreamer");
+    m_dir = QDir(dir);
+}
+
+QString DownloadCache::path(const QUrl &url) const
+{
+    QByteArray key = QCryptographicHash::hash(url.toEncoded(), QCryptographicHash::Sha1).toHex();
+    return m_dir.filePath(QString::fromLatin1(key));
+}
+
+QString DownloadCache::lookup(const QUrl &url) const
+{
+    if (!isEnabled())
+        return QString();
+    QString file = path(url);
+    if (!QFile::exists(file))
+        return QString();
+#ifdef Q_OS_UNIX
+    // Eviction goes by modification time, so mark the entry as recently used.
+    utime(QFile::encodeName(file).constData(), 0);
+#endif
+    return file;
+}
+
+bool DownloadCache::store(const QUrl &url, const QString &file)
+{
+    if (!isEnabled() || QFileInfo(file).size() > m_maxSize)
+        return false;
+    if (!m_dir.exists() && !m_dir.mkpath(QLatin1String(".")))
+        return false;
+
+    QString target = path(url);
+    QString partial = target + QLatin1String(".part");
+    QFile::remove(partial);
+    bool stored = false;
+#ifdef Q_OS_UNIX
+    // A hard link is instant and survives the removal of the temporary file.
+    // Copying instead would block the caller for as long as it takes to
+    // write out the whole download, so if the cache lives on another file
+    // system (EXDEV) the download is simply not cached.
+    stored = ::link(QFile::encodeName(file).constData(), QFile::encodeName(partial).constData()) == 0;
+#endif
+    if (!stored) {
+        debug() << "Could not link" << file << "into the download cache, not caching" << url;
+        return false;
+    }
+
+    QFile::remove(target);
+    if (!QFile::rename(partial, target)) {
+        QFile::remove(partial);
+        return false;
+    }
+    debug() << "Cached" << url << "as" << target;
+    evict();
+    return true;
+}
+
+void DownloadCache::evict()
+{
+    QFileInfoList entries = m_dir.entryInfoList(QDir::Files, QDir::Time);
+    qint64 size = 0;
+    foreach (const QFileInfo &entry, entries)
+        size += entry.size();
+
+    // Sorted newest first, drop from the back.
+    while (size > m_maxSize && !entries.isEmpty()) {
+        const QFileInfo entry = entries.takeLast();
+        if (QFile::remove(entry.filePath()))
+            size -= entry.size();
+    }
+}
+
+}
+}
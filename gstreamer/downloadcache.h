@@ -0,0 +1,63 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_DOWNLOADCACHE_H
+#define PHONON_GSTREAMER_DOWNLOADCACHE_H
+
+#include <QtCore/QDir>
+#include <QtCore/QUrl>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Directory of completely downloaded http sources, keyed by URL.
+ *
+ * The cache is disabled unless PHONON_GST_DOWNLOAD_CACHE_SIZE (in MiB) bounds
+ * its size; the least recently played entries are evicted first. The
+ * directory defaults to phonon-gstreamer in the user's cache location and can
+ * be moved with PHONON_GST_DOWNLOAD_CACHE_DIR. Downloads are hard linked into
+ * it, so it has to be on the same file system as the temporary directory.
+ * Only Unix systems are supported.
+ *
+ * Entries are never revalidated: souphttpsrc does not hand out the response
+ * headers, so there is no ETag to key on.
+ */
+class DownloadCache
+{
+public:
+    DownloadCache();
+
+    bool isEnabled() const { return m_maxSize > 0; }
+
+    /// Path of the cached copy of url, or an empty string.
+    QString lookup(const QUrl &url) const;
+    /// Adds the complete download of url in file to the cache.
+    bool store(const QUrl &url, const QString &file);
+
+private:
+    QString path(const QUrl &url) const;
+    void evict();
+
+    QDir m_dir;
+    qint64 m_maxSize;
+};
+
+}
+}
+
+#endif // PHONON_GSTREAMER_DOWNLOADCACHE_H
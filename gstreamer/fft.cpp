@@ -0,0 +1,119 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fft.h"
+
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+FFT::FFT(int size)
+    : m_size(size)
+    , m_window(size)
+    , m_bitReverse(size)
+    , m_twiddleRe(qMax(size - 1, 1))
+    , m_twiddleIm(qMax(size - 1, 1))
+    , m_re(size)
+    , m_im(size)
+{
+    Q_ASSERT(size > 1 && (size & (size - 1)) == 0);
+
+    float windowSum = 0;
+    for (int i = 0; i < size; ++i) {
+        m_window[i] = 0.5f * (1.0f - cosf(2.0f * float(M_PI) * i / (size - 1)));
+        windowSum += m_window[i];
+    }
+    // Undo the coherent gain of the window and the one sided spectrum.
+    for (int i = 0; i < size; ++i)
+        m_window[i] *= 2.0f / windowSum;
+
+    int bits = 0;
+    while ((1 << bits) < size)
+        ++bits;
+    for (int i = 0; i < size; ++i) {
+        int reversed = 0;
+        for (int b = 0; b < bits; ++b)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        m_bitReverse[i] = reversed;
+    }
+
+    for (int half = 1; half < size; half <<= 1) {
+        for (int j = 0; j < half; ++j) {
+            const double angle = -M_PI * j / half;
+            m_twiddleRe[half - 1 + j] = cos(angle);
+            m_twiddleIm[half - 1 + j] = sin(angle);
+        }
+    }
+}
+
+void FFT::transform(const float *in, float *magnitudes)
+{
+    float *re = m_re.data();
+    float *im = m_im.data();
+    for (int i = 0; i < m_size; ++i) {
+        const int j = m_bitReverse[i];
+        re[j] = in[i] * m_window[i];
+        im[j] = 0;
+    }
+
+    for (int half = 1; half < m_size; half <<= 1) {
+        const float *wr = m_twiddleRe.constData() + half - 1;
+        const float *wi = m_twiddleIm.constData() + half - 1;
+        for (int start = 0; start < m_size; start += 2 * half) {
+            float *ar = re + start;
+            float *ai = im + start;
+            float *br = ar + half;
+            float *bi = ai + half;
+            int j = 0;
+#if defined(__SSE2__)
+            for (; j + 4 <= half; j += 4) {
+                const __m128 twr = _mm_loadu_ps(wr + j);
+                const __m128 twi = _mm_loadu_ps(wi + j);
+                const __m128 xr = _mm_loadu_ps(br + j);
+                const __m128 xi = _mm_loadu_ps(bi + j);
+                const __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, twr), _mm_mul_ps(xi, twi));
+                const __m128 ti = _mm_add_ps(_mm_mul_ps(xr, twi), _mm_mul_ps(xi, twr));
+                const __m128 yr = _mm_loadu_ps(ar + j);
+                const __m128 yi = _mm_loadu_ps(ai + j);
+                _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+                _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+                _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+                _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+            }
+#endif
+            for (; j < half; ++j) {
+                const float tr = br[j] * wr[j] - bi[j] * wi[j];
+                const float ti = br[j] * wi[j] + bi[j] * wr[j];
+                br[j] = ar[j] - tr;
+                bi[j] = ai[j] - ti;
+                ar[j] += tr;
+                ai[j] += ti;
+            }
+        }
+    }
+
+    for (int i = 0; i < m_size / 2; ++i)
+        magnitudes[i] = sqrtf(re[i] * re[i] + im[i] * im[i]);
+}
+
+}
+}
@@ -0,0 +1,59 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_FFT_H
+#define PHONON_GSTREAMER_FFT_H
+
+#include <QtCore/QVector>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Radix-2 FFT of real samples behind a Hann window.
+ *
+ * Real and imaginary parts are kept in separate arrays and the twiddles of
+ * each stage are contiguous, so the butterflies run four at a time with
+ * SSE2. All storage is allocated up front, transform() does not allocate.
+ */
+class FFT
+{
+public:
+    /// size must be a power of two.
+    explicit FFT(int size);
+
+    int size() const { return m_size; }
+
+    /// Magnitudes of the size() / 2 bins of in, which holds size() samples.
+    /// Scaled so that a full scale sine peaks at 1.
+    void transform(const float *in, float *magnitudes);
+
+private:
+    int m_size;
+    QVector<float> m_window;
+    QVector<int> m_bitReverse;
+    // Twiddles of the stage with half length h start at h - 1.
+    QVector<float> m_twiddleRe;
+    QVector<float> m_twiddleIm;
+    QVector<float> m_re;
+    QVector<float> m_im;
+};
+
+}
+}
+
+#endif // PHONON_GSTREAMER_FFT_H
@@ -58,6 +58,7 @@ MediaObject::MediaObject(Backend *backend, QObject *parent)
         , m_state(Phonon::StoppedState)
         , m_pendingState(Phonon::LoadingState)
         , m_tickTimer(new QTimer(this))
+        , m_nextSourceQueued(false)
         , m_prefinishMark(0)
         , m_transitionTime(0)
         , m_isStream(false)
@@ -76,8 +77,6 @@ MediaObject::MediaObject(Backend *backend, QObject *parent)
         , m_waitingForPreviousSource(false)
         , m_skippingEOS(false)
         , m_doingEOS(false)
-        , m_skipGapless(false)
-        , m_handlingAboutToFinish(false)
 {
     qRegisterMetaType<GstCaps*>("GstCaps*");
     qRegisterMetaType<State>("State");
@@ -88,7 +87,7 @@ MediaObject::MediaObject(Backend *backend, QObject *parent)
 
     m_isValid = true;
     m_root = this;
-    m_pipeline = new Pipeline(this);
+    m_pipeline = backend->acquirePipeline(this);
     GlobalSubtitles::instance()->register_(this);
     GlobalAudioChannels::instance()->register_(this);
 
@@ -133,7 +132,7 @@ MediaObject::~MediaObject()
         GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline->element()));
         g_signal_handlers_disconnect_matched(bus, G_SIGNAL_MATCH_DATA, 0, 0, 0, 0, this);
         gst_object_unref(bus);
-        delete m_pipeline;
+        m_backend->releasePipeline(m_pipeline);
     }
     GlobalSubtitles::instance()->unregister_(this);
     GlobalAudioChannels::instance()->unregister_(this);
@@ -337,27 +336,27 @@ void MediaObject::setNextSource(const MediaSource &source)
 {
     DEBUG_BLOCK;
 
-    m_aboutToFinishLock.lock();
-    if (m_handlingAboutToFinish) {
-        debug() << "Got next source. Waiting for end of current.";
-
-        // If next source is valid and is not empty (an empty source is sent by Phonon if
-        // there are no more sources) skip EOS for the current source in order to seamlessly
-        // pass to the next source.
-        if (source.type() == Phonon::MediaSource::Invalid ||
-            source.type() == Phonon::MediaSource::Empty)
-            m_skippingEOS = false;
-        else
-            m_skippingEOS = true;
-
-        m_waitingForNextSource = true;
-        m_waitingForPreviousSource = false;
-        m_skipGapless = false;
-        m_pipeline->setSource(source);
-        m_aboutToFinishWait.wakeAll();
-    } else
-        qDebug() << "Ignoring source as no aboutToFinish handling is in progress.";
-    m_aboutToFinishLock.unlock();
+    // Only queued here, playbin2 is handed the source from
+    // handleAboutToFinish() or, if that already went by, at the end of stream.
+    m_pipeline->prepareNextSource(source);
+    QMutexLocker lock(&m_aboutToFinishLock);
+    debug() << "Got next source. Waiting for end of current.";
+    m_nextSource = source;
+    m_nextSourceQueued = true;
+}
+
+/*
+ * Asks the frontend for the next source, at most once per source.
+ */
+void MediaObject::announceEnd()
+{
+    {
+        QMutexLocker lock(&m_aboutToFinishLock);
+        if (m_aboutToFinishEmitted)
+            return;
+        m_aboutToFinishEmitted = true;
+    }
+    emit aboutToFinish();
 }
 
 qint64 MediaObject::getPipelinePos() const
@@ -386,8 +385,12 @@ void MediaObject::setSource(const MediaSource &source)
     m_source = source;
     autoDetectSubtitle();
     m_pipeline->setSource(source);
-    m_skipGapless = false;
-    m_aboutToFinishWait.wakeAll();
+    {
+        QMutexLocker lock(&m_aboutToFinishLock);
+        m_nextSource = MediaSource();
+        m_nextSourceQueued = false;
+        m_aboutToFinishEmitted = false;
+    }
     //emit currentSourceChanged(source);
 }
 
@@ -483,12 +486,31 @@ void MediaObject::seek(qint64 time)
         debug() << "Seeking back within old source";
         m_waitingForNextSource = false;
         m_waitingForPreviousSource = true;
+        // The reset drops the next source from playbin2, queue it again so
+        // that the next about-to-finish hands it over once more.
+        m_aboutToFinishLock.lock();
+        m_nextSource = m_pipeline->currentSource();
+        m_nextSourceQueued = true;
+        m_aboutToFinishLock.unlock();
+        m_pipeline->prepareNextSource(m_pipeline->currentSource());
         m_pipeline->setSource(m_source, true);
     }
     m_pipeline->seekToMSec(time);
     m_lastTime = 0;
 }
 
+qreal MediaObject::playbackRate() const
+{
+    return m_pipeline->playbackRate();
+}
+
+void MediaObject::setPlaybackRate(qreal rate)
+{
+    DEBUG_BLOCK;
+    if (m_pipeline->setPlaybackRate(rate))
+        m_lastTime = 0;
+}
+
 void MediaObject::handleStreamChange()
 {
     if (m_waitingForPreviousSource) {
@@ -497,6 +519,10 @@ void MediaObject::handleStreamChange()
         m_source = m_pipeline->currentSource();
         m_sourceMeta = m_pipeline->metaData();
         m_waitingForNextSource = false;
+        // The EOS that was to be skipped belonged to the previous source.
+        m_skippingEOS = false;
+        QMutexLocker lock(&m_aboutToFinishLock);
+        m_aboutToFinishEmitted = false;
         emit metaDataChanged(m_pipeline->metaData());
         emit currentSourceChanged(m_pipeline->currentSource());
     }
@@ -528,6 +554,13 @@ void MediaObject::emitTick()
                 emit prefinishMarkReached(totalTime() - currentTime);
             }
         }
+        // playbin2 asks for the next source once the decoders have drained,
+        // which is roughly what is still queued before the sinks. Ask the
+        // frontend a bit before that, so that handleAboutToFinish() finds the
+        // source already waiting and never has to block.
+        if (totalTime() > 0
+                && currentTime >= totalTime() - ABOUT_TO_FINNISH_TIME - m_pipeline->queuedTime())
+            announceEnd();
     }
 }
 
@@ -536,8 +569,10 @@ void MediaObject::emitTick()
  */
 void MediaObject::beginPlay()
 {
-    setSource(m_nextSource);
-    m_nextSource = MediaSource();
+    m_aboutToFinishLock.lock();
+    const MediaSource next = m_nextSource;
+    m_aboutToFinishLock.unlock();
+    setSource(next);
     m_pendingState = Phonon::PlayingState;
 }
 
@@ -589,10 +624,32 @@ void MediaObject::handleEndOfStream()
     if (!m_skippingEOS) {
         debug() << "not skipping EOS";
         m_doingEOS = true;
+        m_aboutToFinishLock.lock();
+        const bool queued = m_nextSourceQueued;
+        MediaSource next = m_nextSource;
+        m_nextSource = MediaSource();
+        m_nextSourceQueued = false;
+        m_aboutToFinishLock.unlock();
+        if (queued && next.type() != MediaSource::Empty) {
+            // The frontend answered after playbin2 had asked, so the
+            // transition cannot be gapless any more. Still play it, the
+            // pipeline keeps the states of the reset to itself.
+            debug() << "Next source came too late for a gapless transition";
+            m_doingEOS = false;
+            m_source = next;
+            autoDetectSubtitle();
+            m_pipeline->switchSource(next);
+            m_sourceMeta = m_pipeline->metaData();
+            {
+                QMutexLocker lock(&m_aboutToFinishLock);
+                m_aboutToFinishEmitted = false;
+            }
+            emit metaDataChanged(m_sourceMeta);
+            emit currentSourceChanged(next);
+            return;
+        }
         { // When working on EOS we do not want signals emitted to avoid bogus UI updates.
             emit stateChanged(Phonon::StoppedState, m_state);
-            m_aboutToFinishWait.wakeAll();
-            m_aboutToFinishLock.unlock();
             m_pipeline->setState(GST_STATE_READY);
             emit finished();
         }
@@ -611,11 +668,37 @@ void MediaObject::handleEndOfStream()
 bool MediaObject::hasInterface(Interface iface) const
 {
     return iface == AddonInterface::TitleInterface || iface == AddonInterface::NavigationInterface
-        || iface == AddonInterface::SubtitleInterface || iface == AddonInterface::AudioChannelInterface;
+        || iface == AddonInterface::SubtitleInterface || iface == AddonInterface::AudioChannelInterface
+        || int(iface) == PlaybackInterface;
 }
 
 QVariant MediaObject::interfaceCall(Interface iface, int command, const QList<QVariant> &params)
 {
+    if (int(iface) == PlaybackInterface) {
+        switch (command)
+        {
+        case seekMode:
+            return int(m_pipeline->seekMode());
+        case setSeekMode:
+            if (params.isEmpty()) {
+                error() << Q_FUNC_INFO << "arguments invalid";
+                return QVariant();
+            }
+            m_pipeline->setSeekMode(static_cast<Pipeline::SeekMode>(params.first().toInt()));
+            break;
+        case rate:
+            return playbackRate();
+        case setRate:
+            if (params.isEmpty()) {
+                error() << Q_FUNC_INFO << "arguments invalid";
+                return QVariant();
+            }
+            setPlaybackRate(params.first().toDouble());
+            break;
+        }
+        return QVariant();
+    }
+
     if (hasInterface(iface)) {
 
         switch (iface)
@@ -878,17 +961,6 @@ void MediaObject::setMetaData(QMultiMap<QString, QString> newData)
 void MediaObject::requestState(Phonon::State state)
 {
     DEBUG_BLOCK;
-    // Only abort handling here iff the handler is active.
-    if (m_aboutToFinishLock.tryLock()) {
-        // Note that this is not condition to unlocking, so the nesting is
-        // necessary.
-        if (m_handlingAboutToFinish) {
-            qDebug() << "Aborting aboutToFinish handling.";
-            m_skipGapless = true;
-            m_aboutToFinishWait.wakeAll();
-        }
-        m_aboutToFinishLock.unlock();
-    }
     debug() << state;
     switch (state) {
         case Phonon::PlayingState:
@@ -914,49 +986,40 @@ void MediaObject::handleAboutToFinish()
 {
     DEBUG_BLOCK;
     debug() << "About to finish";
+    // This runs on a playbin2 streaming thread, which must not wait for the
+    // frontend: the next group only starts decoding once we return. The
+    // source normally got queued already in response to announceEnd().
     m_aboutToFinishLock.lock();
-    m_handlingAboutToFinish = true;
-    if (!m_waitingForNextSource)
-        emit aboutToFinish();
-    // As our signal gets emitted queued we need to wait here until either a
-    // new source or a timeout is reached.
-    // If we got a new source in time -> hooray + gapless
-    // If we did not get a new source in time -> boooh + stop()
-    if (!m_skipGapless) {
-        // Dynamic lock timeout is our friend.
-        // Instead of simply waiting for a fixed amount of ms for the next source, we wait for the
-        // most sensible amount of time. This is whatever amount of time is remaining to play
-        // minus a 0.5 seconds safety delta (time values not precise etc.).
-        // A source for which we have no time or for which the remaining time is < 0.5 seconds is
-        // immediately unlocked again. Otherwise the consumer has as much time as gst gave us to
-        // set a new source.
-        // This in particular prevents pointless excessive locking on sources which have a totalTime
-        // < whatever fixed lock value we have (so that we'd lock longer than what we are playing).
-        // An issue apparent with notification-like sounds, that are rather short and do not need
-        // gapless transitioning. As outlined in https://bugs.kde.org/show_bug.cgi?id=307530
-        unsigned long timeout = 0;
-        if (totalTime() <= 0 || (remainingTime() - 500 <= 0))
-            timeout = 0;
-        else
-            timeout = remainingTime() - 500;
-
-        debug() << "waiting for" << timeout;
-        if (m_aboutToFinishWait.wait(&m_aboutToFinishLock, timeout)) {
-            debug() << "Finally got a source";
-            if (m_skipGapless) { // Was explicitly set by stateChange interrupt
-                debug() << "...oh, no, just got aborted, skipping EOS";
-                m_skippingEOS = false;
-            }
-        } else {
-            warning() << "aboutToFinishWait timed out!";
-            m_skippingEOS = false;
-        }
-    } else {
-        debug() << "Skipping gapless audio";
-        m_skippingEOS = false;
-    }
-    m_handlingAboutToFinish = false;
+    const bool queued = m_nextSourceQueued;
+    MediaSource next = m_nextSource;
+    m_nextSource = MediaSource();
+    m_nextSourceQueued = false;
     m_aboutToFinishLock.unlock();
+
+    if (!queued) {
+        debug() << "No next source queued yet";
+        announceEnd();
+        return;
+    }
+
+    // An empty source is sent by Phonon if there are no more sources.
+    if (next.type() == MediaSource::Empty)
+        return;
+
+    // Everything besides the uri is left to the main thread.
+    if (m_pipeline->setNextSource(next))
+        QMetaObject::invokeMethod(this, "handleNextSource", Qt::QueuedConnection);
+}
+
+/*
+ * playbin2 continues with the next source, skip EOS for the current one in
+ * order to seamlessly pass to it.
+ */
+void MediaObject::handleNextSource()
+{
+    m_skippingEOS = true;
+    m_waitingForNextSource = true;
+    m_waitingForPreviousSource = false;
 }
 
 } // ns Gstreamer
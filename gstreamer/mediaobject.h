@@ -30,7 +30,6 @@
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 #include <QtCore/QVariant>
-#include <QtCore/QWaitCondition>
 #include <QtCore/QMutex>
 
 #include "phonon-config-gstreamer.h" // krazy:exclude=includes
@@ -85,6 +84,10 @@ public:
     void stop();
     void seek(qint64 time);
 
+    // 1.0 is normal speed, see Pipeline::setPlaybackRate()
+    qreal playbackRate() const;
+    void setPlaybackRate(qreal rate);
+
     Phonon::State translateState(GstState state) const;
 
     QString errorString() const;
@@ -103,8 +106,17 @@ public:
     void setNextSource(const MediaSource &source);
     MediaSource source() const;
 
-    // No additional interfaces currently supported
 #ifndef QT_NO_PHONON_MEDIACONTROLLER
+    // Backend specific addition to AddonInterface::Interface, not known to
+    // the frontend but reachable through interfaceCall().
+    enum { PlaybackInterface = 0x1000 };
+    enum PlaybackCommand {
+        seekMode,       // returns Pipeline::SeekMode as int
+        setSeekMode,    // takes Pipeline::SeekMode as int
+        rate,           // returns playbackRate() as double
+        setRate         // takes the rate for setPlaybackRate() as double
+    };
+
     bool hasInterface(Interface) const;
     QVariant interfaceCall(Interface, int, const QList<QVariant> &);
 #endif
@@ -195,6 +207,7 @@ private Q_SLOTS:
     void getAudioChannelInfo(int stream);
     void emitTick();
     void beginPlay();
+    void announceEnd();
     void autoDetectSubtitle();
     void logWarning(const QString &);
 
@@ -204,6 +217,7 @@ private Q_SLOTS:
     void handleDurationChange(qint64);
 
     void handleAboutToFinish();
+    void handleNextSource();
     void handleStreamChange();
 
 private:
@@ -236,6 +250,9 @@ private:
     qint32 m_tickInterval;
 
     MediaSource m_nextSource;
+    // setNextSource() was called since the last handover, m_nextSource may
+    // legitimately be empty to say there is nothing more to play.
+    bool m_nextSourceQueued;
     qint32 m_prefinishMark;
     qint32 m_transitionTime;
     bool m_isStream;
@@ -281,15 +298,11 @@ private:
     Phonon::MediaSource m_source;
     QMultiMap<QString, QString> m_sourceMeta;
 
-    //This simply pauses the gst signal handler 'till we get something
+    // Guards m_nextSource, m_nextSourceQueued and m_aboutToFinishEmitted, which are shared with
+    // the streaming thread running handleAboutToFinish().
     QMutex m_aboutToFinishLock;
-    QWaitCondition m_aboutToFinishWait;
 
     qint64 m_lastTime;
-    bool m_skipGapless;
-
-    /*** Tracks whereever the MO is actively handling an aboutToFinish CB right now. */
-    bool m_handlingAboutToFinish;
 };
 }
 } //namespace Phonon::Gstreamer
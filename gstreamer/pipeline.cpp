@@ -29,9 +29,16 @@
 #include <gst/interfaces/navigation.h>
 #include <gst/app/gstappsrc.h>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
 #include <QtCore/QMutexLocker>
 
-#define MAX_QUEUE_TIME 20 * GST_SECOND
+// A seek that has not completed after this many msec no longer holds back
+// the next one.
+#define SEEK_TIMEOUT 1000
+
+// From playbin2's private GstPlayFlags
+#define GST_PLAY_FLAG_DOWNLOAD (1 << 7)
+
 namespace Phonon
 {
 namespace Gstreamer
@@ -44,20 +51,52 @@ Pipeline::Pipeline(QObject *parent)
     , m_isHttpUrl(false)
     , m_installer(new PluginInstaller(this))
     , m_reader(0) // Lazy init
+    , m_audioQueue(0)
+    , m_videoQueue(0)
+    , m_queuePolicy(cb_queueShareChanged, this)
     , m_resetting(false)
+    , m_stateAfterReset(GST_STATE_VOID_PENDING)
+    , m_asyncBus(qgetenv("PHONON_GST_BUS_DISPATCH") != "sync")
+    , m_interpolatePosition(qgetenv("PHONON_GST_POSITION_QUERY").isEmpty())
+    , m_positionValid(false)
+    , m_positionPlaying(false)
+    , m_positionAnchor(0)
+    , m_runningAnchor(0)
+    , m_capabilitiesValid(false)
+    , m_seekable(false)
+    , m_duration(-1)
+    , m_audioEnd(GST_CLOCK_TIME_NONE)
+    , m_measureGap(false)
+    , m_downloadQueue(0)
+    , m_seekMode(DefaultSeek)
+    , m_seekInFlight(false)
+    , m_seekTarget(0)
+    , m_pendingSeek(-1)
+    , m_pendingSeekMode(DefaultSeek)
+    , m_rate(1.0)
+    , m_scaletempo(0)
+    , m_scaletempoBlock(0)
 {
     qRegisterMetaType<GstState>("GstState");
     m_pipeline = GST_PIPELINE(gst_element_factory_make("playbin2", NULL));
     gst_object_ref(m_pipeline);
     gst_object_sink(m_pipeline);
+    g_object_get(m_pipeline, "flags", &m_defaultFlags, NULL);
     g_signal_connect(m_pipeline, "video-changed", G_CALLBACK(cb_videoChanged), this);
     g_signal_connect(m_pipeline, "text-tags-changed", G_CALLBACK(cb_textTagsChanged), this);
     g_signal_connect(m_pipeline, "audio-tags-changed", G_CALLBACK(cb_audioTagsChanged), this);
     g_signal_connect(m_pipeline, "notify::source", G_CALLBACK(cb_setupSource), this);
     g_signal_connect(m_pipeline, "about-to-finish", G_CALLBACK(cb_aboutToFinish), this);
+    g_signal_connect(m_pipeline, "deep-notify::temp-location", G_CALLBACK(cb_downloadStarted), this);
 
     GstBus *bus = gst_pipeline_get_bus(m_pipeline);
-    gst_bus_set_sync_handler(bus, gst_bus_sync_signal_handler, NULL);
+    // By default messages are only peeked at on the posting thread and
+    // handled from the Qt event loop, see cb_busSync().
+    // PHONON_GST_BUS_DISPATCH=sync handles them on the streaming threads.
+    if (m_asyncBus)
+        gst_bus_set_sync_handler(bus, cb_busSync, this);
+    else
+        gst_bus_set_sync_handler(bus, gst_bus_sync_signal_handler, NULL);
     g_signal_connect(bus, "sync-message::eos", G_CALLBACK(cb_eos), this);
     g_signal_connect(bus, "sync-message::warning", G_CALLBACK(cb_warning), this);
 
@@ -69,6 +108,7 @@ Pipeline::Pipeline(QObject *parent)
     g_signal_connect(bus, "sync-message::element", G_CALLBACK(cb_element), this);
     g_signal_connect(bus, "sync-message::error", G_CALLBACK(cb_error), this);
     g_signal_connect(bus, "sync-message::tag", G_CALLBACK(cb_tag), this);
+    g_signal_connect(bus, "sync-message::async-done", G_CALLBACK(cb_asyncDone), this);
     gst_object_unref(bus);
 
     // Set up audio graph
@@ -76,25 +116,23 @@ Pipeline::Pipeline(QObject *parent)
     gst_object_ref (GST_OBJECT (m_audioGraph));
     gst_object_sink (GST_OBJECT (m_audioGraph));
 
-    // Note that these queues are only required for streaming content
-    // And should ideally be created on demand as they will disable
-    // pull-mode access. Also note that the max-size-time are increased to
-    // reduce buffer overruns as these are not gracefully handled at the moment.
-    m_audioPipe = gst_element_factory_make("queue", "audioPipe");
-    g_object_set(G_OBJECT(m_audioPipe), "max-size-time",  MAX_QUEUE_TIME, NULL);
-
-    QByteArray tegraEnv = qgetenv("TEGRA_GST_OPENMAX");
-    if (!tegraEnv.isEmpty()) {
-        g_object_set(G_OBJECT(m_audioPipe), "max-size-time", 0, NULL);
-        g_object_set(G_OBJECT(m_audioPipe), "max-size-buffers", 0, NULL);
-        g_object_set(G_OBJECT(m_audioPipe), "max-size-bytes", 0, NULL);
-    }
-
+    // The pipes are what MediaNodes link to. Queues in front of them are only
+    // required for streaming content and are inserted on demand by
+    // setQueuing(), as they add a thread and buffered data per stream.
+    m_audioPipe = gst_element_factory_make("identity", "audioPipe");
+    g_object_set(G_OBJECT(m_audioPipe), "silent", TRUE, NULL);
     gst_bin_add(GST_BIN(m_audioGraph), m_audioPipe);
     GstPad *audiopad = gst_element_get_static_pad (m_audioPipe, "sink");
     gst_element_add_pad (m_audioGraph, gst_ghost_pad_new ("sink", audiopad));
     gst_object_unref (audiopad);
 
+    // Watches the audio going into the graph to measure track transitions.
+    gst_segment_init(&m_audioSegment, GST_FORMAT_TIME);
+    audiopad = gst_element_get_static_pad(m_audioGraph, "sink");
+    gst_pad_add_data_probe(audiopad, G_CALLBACK(cb_audioProbe), this);
+    gst_pad_add_event_probe(audiopad, G_CALLBACK(cb_segmentProbe), this);
+    gst_object_unref(audiopad);
+
     g_object_set(m_pipeline, "audio-sink", m_audioGraph, NULL);
 
     // Set up video graph
@@ -102,22 +140,18 @@ Pipeline::Pipeline(QObject *parent)
     gst_object_ref (GST_OBJECT (m_videoGraph));
     gst_object_sink (GST_OBJECT (m_videoGraph));
 
-    m_videoPipe = gst_element_factory_make("queue", "videoPipe");
+    m_videoPipe = gst_element_factory_make("identity", "videoPipe");
+    g_object_set(G_OBJECT(m_videoPipe), "silent", TRUE, NULL);
     gst_bin_add(GST_BIN(m_videoGraph), m_videoPipe);
     GstPad *videopad = gst_element_get_static_pad(m_videoPipe, "sink");
     gst_element_add_pad(m_videoGraph, gst_ghost_pad_new("sink", videopad));
     gst_object_unref(videopad);
+    videopad = gst_element_get_static_pad(m_videoGraph, "sink");
+    gst_pad_add_event_probe(videopad, G_CALLBACK(cb_segmentProbe), this);
+    gst_object_unref(videopad);
 
     g_object_set(m_pipeline, "video-sink", m_videoGraph, NULL);
 
-    //FIXME: Put this stuff somewhere else, or at least document why its needed.
-    if (!tegraEnv.isEmpty()) {
-        //TODO: Move this line into the videooutput
-        //g_object_set(G_OBJECT(videoQueue), "max-size-time", 33000, NULL);
-        g_object_set(G_OBJECT(m_audioPipe), "max-size-buffers", 1, NULL);
-        g_object_set(G_OBJECT(m_audioPipe), "max-size-bytes", 0, NULL);
-    }
-
     connect(m_installer, SIGNAL(failure(QString)), this, SLOT(pluginInstallFailure(QString)));
     connect(m_installer, SIGNAL(started()), this, SLOT(pluginInstallStarted()));
     connect(m_installer, SIGNAL(success()), this, SLOT(pluginInstallComplete()));
@@ -143,30 +177,23 @@ GstElement *Pipeline::videoGraph()
     return m_videoGraph;
 }
 
-void Pipeline::setSource(const Phonon::MediaSource &source, bool reset)
+/*
+ * The playbin2 uri for a source, empty if there is none. Errors are reported
+ * through errorMessage(), which is safe from any thread.
+ */
+QByteArray Pipeline::sourceUri(const Phonon::MediaSource &source)
 {
-    m_isStream = false;
-    m_seeking = false;
-    m_installer->reset();
-    m_resumeAfterInstall = false;
-    m_isHttpUrl = false;
-    m_metaData.clear();
-
-    debug() << "New source:" << source.mrl();
     QByteArray gstUri;
     switch(source.type()) {
         case MediaSource::Url:
         case MediaSource::LocalFile:
             gstUri = source.mrl().toEncoded();
-            if(source.mrl().scheme() == QLatin1String("http"))
-                m_isHttpUrl = true;
             break;
         case MediaSource::Invalid:
             emit errorMessage("Invalid source specified", Phonon::FatalError);
-            return;
+            break;
         case MediaSource::Stream:
             gstUri = "appsrc://";
-            m_isStream = true;
             break;
         case MediaSource::CaptureDevice:
             gstUri = captureDeviceURI(source);
@@ -186,40 +213,490 @@ void Pipeline::setSource(const Phonon::MediaSource &source, bool reset)
                     break;
                 case Phonon::NoDisc:
                     emit errorMessage("Invalid disk source specified", Phonon::FatalError);
-                    return;
+                    break;
             }
             break;
         case MediaSource::Empty:
-            return;
+            break;
     }
+    return gstUri;
+}
+
+static bool isHttpSource(const Phonon::MediaSource &source)
+{
+    return source.type() == MediaSource::Url
+        && source.mrl().scheme() == QLatin1String("http");
+}
 
+// Forgets everything learned about the previous source.
+void Pipeline::beginSource(const Phonon::MediaSource &source)
+{
+    m_isStream = source.type() == MediaSource::Stream;
+    m_isHttpUrl = isHttpSource(source);
+    m_seeking = false;
+    m_seekInFlight = false;
+    m_pendingSeek = -1;
+    m_installer->reset();
+    m_resumeAfterInstall = false;
+    m_metaData.clear();
+    invalidatePosition();
+    invalidateCapabilities();
     //TODO: Test this to make sure that resuming playback after plugin installation
     //when using an abstract stream source doesn't explode.
     m_currentSource = source;
+}
+
+void Pipeline::setSource(const Phonon::MediaSource &source, bool reset)
+{
+    loadSource(source, reset, reset ? position() : 0);
+}
+
+/*
+ * Replaces the source of a running pipeline, e.g. when the next source of a
+ * queue came too late for a gapless transition. This takes the same detour
+ * through READY as a reverse seek and the frontend does not see it either,
+ * playback continues at the start of the new source in the current state.
+ */
+void Pipeline::switchSource(const Phonon::MediaSource &source)
+{
+    loadSource(source, true, 0);
+}
+
+void Pipeline::loadSource(const Phonon::MediaSource &source, bool reset, qint64 resumeAt)
+{
+    debug() << "New source:" << source.mrl();
+    QByteArray gstUri = sourceUri(source);
+    if (gstUri.isEmpty())
+        return;
+    {
+        // A gapless handover still waiting for commitNextSource() is void now.
+        QMutexLocker lock(&m_nextSourceLock);
+        m_nextSource = MediaSource();
+    }
+    beginSource(source);
+    gstUri = setupDownload(source.mrl(), gstUri, m_isHttpUrl, false);
 
     GstState oldState = state();
+    m_stateAfterReset = GST_STATE_VOID_PENDING;
 
+    // Once playbin2 has been given the next uri for a gapless transition, the
+    // current stream's decoders have drained and playbin2 cannot go back to
+    // it. playbin2 only builds a decoder chain for its uri when it goes to
+    // PAUSED or from about-to-finish, so there is no way to re-target it in
+    // place and seeking there needs a reset through READY.
     if (reset && oldState > GST_STATE_READY) {
-        debug() << "Resetting pipeline for reverse seek";
+        debug() << "Resetting pipeline";
         m_resetting = true;
-        m_posAtReset = position();
+        m_stateAfterReset = oldState;
+        m_posAtReset = resumeAt;
         gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_READY);
+        // Whatever is still on the bus predates the reset. A state change or
+        // the ASYNC_DONE of an earlier preroll must not be taken for the
+        // reset's own, see cb_state(). Calls queued for those messages are
+        // voided like in reset(), nothing gets posted while the bus flushes.
+        GstBus *bus = gst_pipeline_get_bus(m_pipeline);
+        gst_bus_set_flushing(bus, TRUE);
+        m_generation.ref();
+        m_busScheduled.fetchAndStoreOrdered(0);
+        gst_bus_set_flushing(bus, FALSE);
+        gst_object_unref(bus);
+    }
+
+    // The sink graphs can only be rewired while they are not running. A next
+    // source set for gapless playback keeps whatever the current one uses.
+    if (oldState <= GST_STATE_READY || reset) {
+        m_queuePolicy.setType(QueuePolicy::sourceType(source));
+        setQueuing(m_queuePolicy.needsQueue());
     }
 
     debug() << "uri" << gstUri;
     g_object_set(m_pipeline, "uri", gstUri.constData(), NULL);
 
+    // Only preroll, cb_state() seeks as soon as that is done and the old
+    // state is restored once the seek has completed. That way the start of
+    // the stream is never rendered and the frontend never sees the detour.
     if (reset && oldState > GST_STATE_READY) {
-        gst_element_set_state(GST_ELEMENT(m_pipeline), oldState);
+        gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_PAUSED);
+    }
+}
+
+/*
+ * Gapless handover from playbin2's about-to-finish, on a streaming thread.
+ * Only the uri is set here, it has to be in place before we return. The
+ * rest of what setSource() does touches state owned by the main thread and
+ * happens in commitNextSource().
+ */
+bool Pipeline::setNextSource(const Phonon::MediaSource &source)
+{
+    debug() << "Next source:" << source.mrl();
+    QByteArray gstUri = sourceUri(source);
+    if (gstUri.isEmpty())
+        return false;
+    gstUri = setupDownload(source.mrl(), gstUri, isHttpSource(source), true);
+    {
+        QMutexLocker lock(&m_nextSourceLock);
+        m_nextSource = source;
+    }
+    g_object_set(m_pipeline, "uri", gstUri.constData(), NULL);
+    invokeLater("commitNextSource");
+    return true;
+}
+
+void Pipeline::commitNextSource(int generation)
+{
+    if (generation != m_generation)
+        return;
+    MediaSource source;
+    {
+        QMutexLocker lock(&m_nextSourceLock);
+        source = m_nextSource;
+        m_nextSource = MediaSource();
+    }
+    if (source.type() == MediaSource::Empty)
+        return;
+    beginSource(source);
+}
+
+void Pipeline::restoreStateAfterReset()
+{
+    if (m_stateAfterReset == GST_STATE_VOID_PENDING)
+        return;
+    const GstState state = m_stateAfterReset;
+    m_stateAfterReset = GST_STATE_VOID_PENDING;
+    debug() << "Reset done, back to" << GstHelper::stateName(state);
+    if (state != GST_STATE_PAUSED)
+        gst_element_set_state(GST_ELEMENT(m_pipeline), state);
+}
+
+void Pipeline::prepareNextSource(const Phonon::MediaSource &source)
+{
+    QString cached;
+    if (isHttpSource(source) && m_downloadCache.isEnabled())
+        cached = m_downloadCache.lookup(source.mrl());
+    QMutexLocker lock(&m_downloadLock);
+    m_preparedUrl = source.mrl();
+    m_preparedFile = cached;
+}
+
+/*
+ * http sources are played from the download cache if they are in it.
+ * Otherwise playbin2 is asked to download them progressively, which makes
+ * seeks within what has arrived so far local, and the download is added to
+ * the cache once complete, see checkDownload().
+ */
+QByteArray Pipeline::setupDownload(const QUrl &url, const QByteArray &gstUri, bool isHttpUrl, bool prepared)
+{
+    QMutexLocker lock(&m_downloadLock);
+    if (m_downloadQueue) {
+        gst_object_unref(m_downloadQueue);
+        m_downloadQueue = 0;
+    }
+    m_downloadFile.clear();
+    m_downloadUrl = QUrl();
+
+    guint flags;
+    g_object_get(m_pipeline, "flags", &flags, NULL);
+    flags &= ~GST_PLAY_FLAG_DOWNLOAD;
+
+    QByteArray uri = gstUri;
+    if (isHttpUrl && m_downloadCache.isEnabled()) {
+        // A gapless handover runs on a streaming thread, which must not wait
+        // for the disk. It takes what prepareNextSource() found instead.
+        QString cached;
+        if (!prepared)
+            cached = m_downloadCache.lookup(url);
+        else if (url == m_preparedUrl)
+            cached = m_preparedFile;
+        if (!cached.isEmpty()) {
+            debug() << "Playing" << url << "from the download cache";
+            uri = QUrl::fromLocalFile(cached).toEncoded();
+        } else {
+            m_downloadUrl = url;
+            flags |= GST_PLAY_FLAG_DOWNLOAD;
+        }
+    }
+    g_object_set(m_pipeline, "flags", flags, NULL);
+    return uri;
+}
+
+/*
+ * In download mode playbin2 puts a queue2 behind the source that writes to a
+ * temporary file, it tells us where through temp-location.
+ */
+void Pipeline::cb_downloadStarted(GstObject *pipeline, GstObject *object, GParamSpec *param, gpointer data)
+{
+    Q_UNUSED(pipeline);
+    Q_UNUSED(param);
+    Pipeline *that = static_cast<Pipeline*>(data);
+    gchar *location = 0;
+    g_object_get(object, "temp-location", &location, NULL);
+    if (!location)
+        return;
+
+    QMutexLocker lock(&that->m_downloadLock);
+    if (that->m_downloadQueue)
+        gst_object_unref(that->m_downloadQueue);
+    that->m_downloadQueue = GST_ELEMENT(gst_object_ref(object));
+    that->m_downloadFile = QFile::decodeName(location);
+    debug() << "Downloading to" << that->m_downloadFile;
+    g_free(location);
+}
+
+/*
+ * Hands the download over to the cache once queue2 has every byte of it.
+ */
+void Pipeline::checkDownload()
+{
+    QMutexLocker lock(&m_downloadLock);
+    if (!m_downloadQueue || m_downloadUrl.isEmpty())
+        return;
+
+    GstQuery *query = gst_query_new_buffering(GST_FORMAT_BYTES);
+    if (gst_element_query(m_downloadQueue, query)) {
+        GstFormat format;
+        gint64 start, stop, total;
+        gst_query_parse_buffering_range(query, &format, &start, &stop, &total);
+        if (format == GST_FORMAT_BYTES && total > 0 && start == 0 && stop >= total) {
+            m_downloadCache.store(m_downloadUrl, m_downloadFile);
+            m_downloadUrl = QUrl();
+        }
     }
+    gst_query_unref(query);
 }
 
 Pipeline::~Pipeline()
 {
+    GstBus *bus = gst_pipeline_get_bus(m_pipeline);
+    gst_bus_set_sync_handler(bus, NULL, NULL);
+    gst_object_unref(bus);
     gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
+    unblockScaletempo();
+    if (m_downloadQueue)
+        gst_object_unref(m_downloadQueue);
+    if (m_scaletempo)
+        gst_object_unref(m_scaletempo);
     gst_object_unref(m_pipeline);
 }
 
+/*
+ * Puts a new queue between the sink pad of a graph and its pipe.
+ */
+static GstElement *insertQueue(GstElement *graph, GstElement *pipe, const char *name)
+{
+    GstElement *queue = gst_element_factory_make("queue", name);
+    gst_bin_add(GST_BIN(graph), queue);
+    gst_element_link(queue, pipe);
+
+    GstPad *ghostPad = gst_element_get_static_pad(graph, "sink");
+    GstPad *queuePad = gst_element_get_static_pad(queue, "sink");
+    gst_ghost_pad_set_target(GST_GHOST_PAD(ghostPad), queuePad);
+    gst_object_unref(queuePad);
+    gst_object_unref(ghostPad);
+
+    gst_element_sync_state_with_parent(queue);
+    return queue;
+}
+
+static void removeQueue(GstElement *graph, GstElement *pipe, GstElement *queue)
+{
+    GstPad *ghostPad = gst_element_get_static_pad(graph, "sink");
+    GstPad *pipePad = gst_element_get_static_pad(pipe, "sink");
+    gst_element_set_state(queue, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(graph), queue);
+    gst_ghost_pad_set_target(GST_GHOST_PAD(ghostPad), pipePad);
+    gst_object_unref(pipePad);
+    gst_object_unref(ghostPad);
+}
+
+/*
+ * Local files and discs are decoded on demand and can be pulled by the
+ * demuxers, whereas network, appsrc and capture sources deliver data at
+ * their own pace and need queues to absorb the jitter. Only call this while
+ * the pipeline is at most READY.
+ */
+void Pipeline::setQueuing(bool enable)
+{
+    if (enable == (m_audioQueue != 0))
+        return;
+    debug() << (enable ? "Inserting" : "Removing") << "sink graph queues";
+
+    if (!enable) {
+        removeQueue(m_audioGraph, audioHead(), m_audioQueue);
+        removeQueue(m_videoGraph, m_videoPipe, m_videoQueue);
+        m_audioQueue = 0;
+        m_videoQueue = 0;
+        return;
+    }
+
+    m_audioQueue = insertQueue(m_audioGraph, audioHead(), "audioQueue");
+    m_videoQueue = insertQueue(m_videoGraph, m_videoPipe, "videoQueue");
+    applyQueueLimits();
+}
+
+static void setQueueLimits(GstElement *queue, const QueueSize &limits)
+{
+    g_object_set(G_OBJECT(queue),
+                 "max-size-time", limits.time,
+                 "max-size-bytes", limits.bytes,
+                 "max-size-buffers", limits.buffers,
+                 NULL);
+}
+
+static QueueSize queueLevel(GstElement *queue)
+{
+    QueueSize level;
+    if (queue) {
+        g_object_get(G_OBJECT(queue),
+                     "current-level-time", &level.time,
+                     "current-level-bytes", &level.bytes,
+                     "current-level-buffers", &level.buffers,
+                     NULL);
+    }
+    return level;
+}
+
+void Pipeline::applyQueueLimits()
+{
+    if (m_audioQueue) {
+        const QueueSize audio = m_queuePolicy.audioLimits();
+        const QueueSize video = m_queuePolicy.videoLimits();
+        debug() << "Queue limits, audio:" << audio.time / GST_MSECOND << "ms" << audio.bytes << "bytes"
+                << "video:" << video.time / GST_MSECOND << "ms" << video.bytes << "bytes";
+        setQueueLimits(m_audioQueue, audio);
+        setQueueLimits(m_videoQueue, video);
+    }
+
+    // Only picked up by playbin2 for the next source it opens.
+    const int networkBuffer = m_queuePolicy.networkBufferSize();
+    if (networkBuffer > 0 && g_object_class_find_property(G_OBJECT_GET_CLASS(m_pipeline), "buffer-size"))
+        g_object_set(m_pipeline, "buffer-size", networkBuffer, NULL);
+}
+
+/*
+ * Another pipeline started or stopped queuing. Pipelines and their policies
+ * live on the main thread, so this runs there too.
+ */
+void Pipeline::cb_queueShareChanged(gpointer data)
+{
+    Pipeline *that = static_cast<Pipeline*>(data);
+    that->applyQueueLimits();
+}
+
+QueueSize Pipeline::audioQueueLevel() const
+{
+    return queueLevel(m_audioQueue);
+}
+
+QueueSize Pipeline::videoQueueLevel() const
+{
+    return queueLevel(m_videoQueue);
+}
+
+/*
+ * Removes everything MediaNodes linked into a sink graph, keeping only the
+ * graph's own pipe element.
+ */
+static void clearGraph(GstElement *graph, GstElement *pipe)
+{
+    QList<GstElement*> elements;
+    GstIterator *it = gst_bin_iterate_elements(GST_BIN(graph));
+    gpointer item;
+    bool done = false;
+    while (!done) {
+        switch (gst_iterator_next(it, &item)) {
+        case GST_ITERATOR_OK:
+            if (item != pipe)
+                elements.append(GST_ELEMENT(item));
+            else
+                gst_object_unref(item);
+            break;
+        case GST_ITERATOR_RESYNC:
+            foreach (GstElement *element, elements)
+                gst_object_unref(element);
+            elements.clear();
+            gst_iterator_resync(it);
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    gst_iterator_free(it);
+
+    foreach (GstElement *element, elements) {
+        gst_element_set_state(element, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(graph), element);
+        gst_object_unref(element);
+    }
+}
+
+/*
+ * Queued calls carry the generation they were made in, so that reset()
+ * can void them.
+ */
+void Pipeline::invokeLater(const char *method)
+{
+    QMetaObject::invokeMethod(this, method, Qt::QueuedConnection, Q_ARG(int, m_generation));
+}
+
+void Pipeline::reset()
+{
+    DEBUG_BLOCK;
+    gst_element_set_state(GST_ELEMENT(m_pipeline), GST_STATE_NULL);
+    // A rate change may still be waiting for its pad block, which would
+    // stall the next user of this pipeline.
+    unblockScaletempo();
+
+    // Whoever used this pipeline before is gone, drop everything they left,
+    // including calls still queued for them.
+    disconnect(this, 0, 0, 0);
+    m_generation.ref();
+    m_busScheduled.fetchAndStoreOrdered(0);
+    setQueuing(false);
+    removeScaletempo();
+    m_rate = 1.0;
+    m_queuePolicy.setType(QueuePolicy::LocalSource);
+    m_queuePolicy.setBitrate(0);
+    clearGraph(m_audioGraph, m_audioPipe);
+    clearGraph(m_videoGraph, m_videoPipe);
+    g_object_set(m_pipeline, "flags", m_defaultFlags, "suburi", NULL, NULL);
+
+    if (m_reader) {
+        m_reader->stop();
+        delete m_reader;
+        m_reader = 0;
+    }
+
+    m_currentSource = MediaSource();
+    m_metaData.clear();
+    m_menus.clear();
+    m_bufferPercent = 0;
+    m_isStream = false;
+    m_isHttpUrl = false;
+    m_seeking = false;
+    m_seekMode = DefaultSeek;
+    m_seekInFlight = false;
+    m_pendingSeek = -1;
+    m_resetting = false;
+    m_stateAfterReset = GST_STATE_VOID_PENDING;
+    m_resumeAfterInstall = false;
+    m_installer->reset();
+    invalidatePosition();
+    invalidateCapabilities();
+    setupDownload(QUrl(), QByteArray(), false, false);
+    {
+        QMutexLocker lock(&m_downloadLock);
+        m_preparedUrl = QUrl();
+        m_preparedFile.clear();
+    }
+    {
+        QMutexLocker lock(&m_nextSourceLock);
+        m_nextSource = MediaSource();
+    }
+    m_resetAudioProbe.fetchAndStoreOrdered(1);
+    m_transitionGap.fetchAndStoreOrdered(0);
+}
+
 GstElement *Pipeline::element() const
 {
     return GST_ELEMENT(m_pipeline);
@@ -236,6 +713,13 @@ GstStateChangeReturn Pipeline::setState(GstState state)
         m_reader->stop();
     }
 
+    invalidatePosition();
+    m_stateAfterReset = GST_STATE_VOID_PENDING;
+    if (state <= GST_STATE_READY) {
+        m_resetAudioProbe.fetchAndStoreOrdered(1);
+        m_seekInFlight = false;
+        m_pendingSeek = -1;
+    }
     return gst_element_set_state(GST_ELEMENT(m_pipeline), state);
 }
 
@@ -262,10 +746,79 @@ GstState Pipeline::state() const
     return state;
 }
 
+GstBusSyncReply Pipeline::cb_busSync(GstBus *bus, GstMessage *gstMessage, gpointer data)
+{
+    Pipeline *that = static_cast<Pipeline*>(data);
+
+    // The video sink blocks until it has been given a window, so this one
+    // has to be answered right away from the thread that posted it.
+    if (GST_MESSAGE_TYPE(gstMessage) == GST_MESSAGE_ELEMENT
+            && gst_structure_has_name(gst_message_get_structure(gstMessage), "prepare-xwindow-id")) {
+        gst_bus_sync_signal_handler(bus, gstMessage, NULL);
+        return GST_BUS_DROP;
+    }
+
+    if (GST_MESSAGE_TYPE(gstMessage) == GST_MESSAGE_ASYNC_DONE)
+        that->m_asyncDoneSerial.fetchAndStoreOrdered(that->m_seekSerial);
+
+    // Everything else stays queued on the bus. Only the first message after
+    // a drain wakes up the main thread, the rest is picked up along with it.
+    if (that->m_busScheduled.testAndSetOrdered(0, 1))
+        that->invokeLater("processBusMessages");
+    return GST_BUS_PASS;
+}
+
+/*
+ * Consecutive messages that only carry a new value of the same quantity are
+ * collapsed into the last one, e.g. a burst of buffering percentages.
+ */
+static bool canCoalesce(GstMessage *previous, GstMessage *next)
+{
+    if (GST_MESSAGE_TYPE(previous) != GST_MESSAGE_TYPE(next)
+            || GST_MESSAGE_SRC(previous) != GST_MESSAGE_SRC(next))
+        return false;
+    switch (GST_MESSAGE_TYPE(next)) {
+    case GST_MESSAGE_BUFFERING:
+    case GST_MESSAGE_DURATION:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Pipeline::processBusMessages(int generation)
+{
+    if (generation != m_generation)
+        return;
+    // Reset before draining, anything posted from now on schedules a new run.
+    m_busScheduled.fetchAndStoreOrdered(0);
+
+    GstBus *bus = gst_pipeline_get_bus(m_pipeline);
+    QList<GstMessage*> messages;
+    while (GstMessage *gstMessage = gst_bus_pop(bus)) {
+        if (!messages.isEmpty() && canCoalesce(messages.last(), gstMessage)) {
+            gst_message_unref(messages.last());
+            messages.last() = gstMessage;
+        } else {
+            messages.append(gstMessage);
+        }
+    }
+
+    // Re-emit them as sync-message::* so the regular handlers run, only now
+    // on this thread.
+    foreach (GstMessage *gstMessage, messages) {
+        gst_bus_sync_signal_handler(bus, gstMessage, NULL);
+        gst_message_unref(gstMessage);
+    }
+    gst_object_unref(bus);
+}
+
 gboolean Pipeline::cb_eos(GstBus *bus, GstMessage *gstMessage, gpointer data)
 {
     Q_UNUSED(bus)
     Pipeline *that = static_cast<Pipeline*>(data);
+    that->invalidatePosition();
+    that->checkDownload();
     emit that->eos();
     return true;
 }
@@ -292,6 +845,7 @@ gboolean Pipeline::cb_duration(GstBus *bus, GstMessage *gstMessage, gpointer dat
     GstFormat format;
     Pipeline *that = static_cast<Pipeline*>(data);
     debug() << "Duration message";
+    that->invalidateCapabilities();
     if (that->m_resetting)
         return true;
     gst_message_parse_duration(gstMessage, &format, &duration);
@@ -301,6 +855,14 @@ gboolean Pipeline::cb_duration(GstBus *bus, GstMessage *gstMessage, gpointer dat
 }
 
 qint64 Pipeline::totalDuration() const
+{
+    QMutexLocker lock(&m_capabilitiesLock);
+    if (updateCapabilities())
+        return m_duration;
+    return queryTotalDuration();
+}
+
+qint64 Pipeline::queryTotalDuration() const
 {
     GstFormat format = GST_FORMAT_TIME;
     gint64 duration = 0;
@@ -310,17 +872,43 @@ qint64 Pipeline::totalDuration() const
     return -1;
 }
 
+/*
+ * Duration and seekability only change with the stream, so they are queried
+ * once the pipeline has prerolled and then served from memory until a
+ * stream change or DURATION message. Expects m_capabilitiesLock to be held,
+ * returns false if the pipeline is not prerolled yet.
+ */
+bool Pipeline::updateCapabilities() const
+{
+    if (m_capabilitiesValid)
+        return true;
+    if (GST_STATE(m_pipeline) < GST_STATE_PAUSED)
+        return false;
+    m_duration = queryTotalDuration();
+    m_seekable = querySeekable();
+    m_capabilitiesValid = true;
+    return true;
+}
+
+void Pipeline::invalidateCapabilities()
+{
+    QMutexLocker lock(&m_capabilitiesLock);
+    m_capabilitiesValid = false;
+}
+
 gboolean Pipeline::cb_buffering(GstBus *bus, GstMessage *gstMessage, gpointer data)
 {
     Q_UNUSED(bus)
     Pipeline *that = static_cast<Pipeline*>(data);
     gint percent = 0;
     gst_structure_get_int (gstMessage->structure, "buffer-percent", &percent); //gst_message_parse_buffering was introduced in 0.10.11
+    that->invalidatePosition();
 
     if (that->m_bufferPercent != percent) {
         emit that->buffering(percent);
         that->m_bufferPercent = percent;
     }
+    that->checkDownload();
 
     return true;
 }
@@ -343,6 +931,9 @@ gboolean Pipeline::cb_state(GstBus *bus, GstMessage *gstMessage, gpointer data)
         return true;
     }
 
+    // Every transition moves the base time or stops the clock.
+    that->invalidatePosition();
+
     // Apparently gstreamer sometimes enters the same state twice.
     // FIXME: Sometimes we enter the same state twice. currently not disallowed by the state machine
     if (that->m_seeking) {
@@ -362,12 +953,18 @@ gboolean Pipeline::cb_state(GstBus *bus, GstMessage *gstMessage, gpointer data)
         that->m_installer->checkInstalledPlugins();
     }
 
+    if (newState <= GST_STATE_READY)
+        that->invalidateCapabilities();
+
     //FIXME: This is a hack until proper state engine is implemented in the pipeline
     // Wait to update stuff until we're at the final requested state
     if (pendingState == GST_STATE_VOID_PENDING && newState > GST_STATE_READY && that->m_resetting) {
         that->m_resetting = false;
-        that->seekToMSec(that->m_posAtReset);
-//        return;
+        // A new source already starts at 0.
+        if (that->m_posAtReset > 0)
+            that->seekTo(that->m_posAtReset, AccurateSeek);
+        if (!that->m_seekInFlight)
+            that->restoreStateAfterReset();
     }
 
     if (pendingState == GST_STATE_VOID_PENDING) {
@@ -375,6 +972,9 @@ gboolean Pipeline::cb_state(GstBus *bus, GstMessage *gstMessage, gpointer data)
         emit that->seekableChanged(that->isSeekable());
     }
 
+    // Transitions of a reset are not the frontend's business.
+    if (that->m_resetting || that->m_stateAfterReset != GST_STATE_VOID_PENDING)
+        return true;
     emit that->stateChanged(oldState, newState);
     return true;
 }
@@ -451,6 +1051,8 @@ gboolean Pipeline::cb_element(GstBus *bus, GstMessage *gstMessage, gpointer data
         g_object_get(that->m_pipeline, "uri", &uri, NULL);
         debug() << "Stream changed to" << uri;
         g_free(uri);
+        that->invalidatePosition();
+        that->invalidateCapabilities();
         if (!that->m_resetting)
             emit that->streamChanged();
     }
@@ -578,6 +1180,14 @@ gboolean Pipeline::cb_tag(GstBus *bus, GstMessage *msg, gpointer data)
         gst_tag_list_foreach (tag_list, &foreach_tag_function, &newTags);
         gst_tag_list_free(tag_list);
 
+        // The encoded bitrate decides how much network buffering is worth it.
+        const QString bitrate = newTags.contains("BITRATE") ? newTags.value("BITRATE")
+                                                            : newTags.value("NOMINAL-BITRATE");
+        if (!bitrate.isEmpty() && bitrate.toInt() != that->m_queuePolicy.bitrate()) {
+            that->m_queuePolicy.setBitrate(bitrate.toInt());
+            that->applyQueueLimits();
+        }
+
         // Determine if we should no fake the album/artist tags.
         // This is a little confusing as we want to fake it on initial
         // connection where title, album and artist are all missing.
@@ -748,19 +1358,392 @@ QList<MediaController::NavigationMenu> Pipeline::availableMenus() const
     return m_menus;
 }
 
+static GstSeekFlags seekFlags(Pipeline::SeekMode mode)
+{
+    int flags = GST_SEEK_FLAG_FLUSH;
+    switch (mode) {
+    case Pipeline::DefaultSeek:
+        break;
+    case Pipeline::KeyframeSeek:
+        flags |= GST_SEEK_FLAG_KEY_UNIT;
+        break;
+    case Pipeline::SnapBeforeSeek:
+        flags |= GST_SEEK_FLAG_KEY_UNIT;
+#if GST_VERSION >= GST_VERSION_CHECK(0,10,29,0)
+        flags |= GST_SEEK_FLAG_SNAP_BEFORE;
+#endif
+        break;
+    case Pipeline::SnapAfterSeek:
+        flags |= GST_SEEK_FLAG_KEY_UNIT;
+#if GST_VERSION >= GST_VERSION_CHECK(0,10,29,0)
+        flags |= GST_SEEK_FLAG_SNAP_AFTER;
+#endif
+        break;
+    case Pipeline::AccurateSeek:
+        flags |= GST_SEEK_FLAG_ACCURATE;
+        break;
+    }
+    return static_cast<GstSeekFlags>(flags);
+}
+
+Pipeline::SeekMode Pipeline::seekMode() const
+{
+    return m_seekMode;
+}
+
+void Pipeline::setSeekMode(SeekMode mode)
+{
+    if (mode < DefaultSeek || mode > AccurateSeek) {
+        Debug::warning() << "Invalid seek mode" << mode;
+        return;
+    }
+    m_seekMode = mode;
+}
+
 bool Pipeline::seekToMSec(qint64 time)
+{
+    return seekTo(time, m_seekMode);
+}
+
+/*
+ * The seek mode only applies to seeks the user asked for. Internal ones,
+ * which restore a position after a reset or a rate change, have to land
+ * where playback was and are always accurate.
+ */
+bool Pipeline::seekTo(qint64 time, SeekMode mode)
 {
     m_posAtReset = time;
     if (m_resetting)
         return true;
-    if (state() == GST_STATE_PLAYING)
+
+    // Every flushing seek tears down and refills the whole decode chain. While
+    // one is still in flight (e.g. the user drags a slider) only the latest
+    // target is kept, and issued once the previous seek has completed.
+    if (m_seekInFlight && m_seekTime.elapsed() < SEEK_TIMEOUT) {
+        m_pendingSeek = time;
+        m_pendingSeekMode = mode;
+        return true;
+    }
+    return issueSeek(time, mode);
+}
+
+bool Pipeline::issueSeek(qint64 time, SeekMode mode)
+{
+    m_pendingSeek = -1;
+    const GstState current = state();
+    if (current == GST_STATE_PLAYING)
         m_seeking = true;
-    return gst_element_seek(GST_ELEMENT(m_pipeline), 1.0, GST_FORMAT_TIME,
-                     GST_SEEK_FLAG_FLUSH, GST_SEEK_TYPE_SET,
+    invalidatePosition();
+    m_seekSerial.ref();
+    const bool result = gst_element_seek(GST_ELEMENT(m_pipeline), m_rate, GST_FORMAT_TIME,
+                     seekFlags(mode), GST_SEEK_TYPE_SET,
                      time * GST_MSECOND, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    // Only a prerolled pipeline answers with ASYNC_DONE.
+    m_seekInFlight = result && current >= GST_STATE_PAUSED;
+    if (m_seekInFlight) {
+        m_seekTarget = time;
+        m_seekTime.start();
+    }
+    return result;
+}
+
+gboolean Pipeline::cb_asyncDone(GstBus *bus, GstMessage *gstMessage, gpointer data)
+{
+    Q_UNUSED(bus)
+    Q_UNUSED(gstMessage)
+    Pipeline *that = static_cast<Pipeline*>(data);
+    // Handled as it is posted, otherwise cb_busSync() already took note.
+    if (!that->m_asyncBus)
+        that->m_asyncDoneSerial.fetchAndStoreOrdered(that->m_seekSerial);
+    // Never seek from a streaming thread.
+    that->invokeLater("seekCompleted");
+    return true;
+}
+
+void Pipeline::seekCompleted(int generation)
+{
+    if (generation != m_generation)
+        return;
+    if (!m_seekInFlight)
+        return;
+    // An ASYNC_DONE posted before the seek went out, e.g. by the preroll,
+    // says nothing about the seek.
+    if (m_asyncDoneSerial != m_seekSerial)
+        return;
+    m_seekInFlight = false;
+    if (m_pendingSeek >= 0) {
+        debug() << "Issuing coalesced seek to" << m_pendingSeek;
+        issueSeek(m_pendingSeek, m_pendingSeekMode);
+    }
+    if (!m_seekInFlight)
+        restoreStateAfterReset();
+}
+
+double Pipeline::playbackRate() const
+{
+    return m_rate;
+}
+
+/*
+ * The rate is part of the segment, so changing it takes a seek to the
+ * current position. Both audio and video follow the new segment and stay in
+ * sync, scaletempo is inserted in front of the audio pipe to keep the pitch.
+ */
+bool Pipeline::setPlaybackRate(double rate)
+{
+    // Reverse playback needs demuxer support we cannot count on.
+    if (rate <= 0.0) {
+        Debug::warning() << "Unsupported playback rate" << rate;
+        return false;
+    }
+    if (qFuzzyCompare(rate, m_rate))
+        return true;
+
+    debug() << "Playback rate" << m_rate << "->" << rate;
+    const qint64 pos = position();
+    {
+        QMutexLocker lock(&m_positionLock);
+        m_rate = rate;
+    }
+    invalidatePosition();
+    updateScaletempo();
+    // Otherwise the first segment picks it up, see cb_segmentProbe().
+    if (state() < GST_STATE_PAUSED)
+        return true;
+    return seekTo(pos, AccurateSeek);
+}
+
+// Same comparison as setPlaybackRate(), so that all agree on what 1.0 is.
+static bool isNormalRate(double rate)
+{
+    return qFuzzyCompare(rate, 1.0);
+}
+
+/*
+ * Every new stream starts with a segment at normal speed, including the next
+ * one of a gapless transition. A flushing seek would throw the transition
+ * away, so instead the segment is sent on with the current rate, which the
+ * sinks and scaletempo then apply.
+ */
+gboolean Pipeline::cb_segmentProbe(GstPad *pad, GstEvent *event, gpointer data)
+{
+    if (GST_EVENT_TYPE(event) != GST_EVENT_NEWSEGMENT)
+        return TRUE;
+    Pipeline *that = static_cast<Pipeline*>(data);
+    double target;
+    {
+        QMutexLocker lock(&that->m_positionLock);
+        target = that->m_rate;
+    }
+    gboolean update;
+    gdouble rate, appliedRate;
+    GstFormat format;
+    gint64 start, stop, position;
+    gst_event_parse_new_segment_full(event, &update, &rate, &appliedRate,
+                                     &format, &start, &stop, &position);
+    if (isNormalRate(target) || rate != 1.0 || appliedRate != 1.0 || format != GST_FORMAT_TIME)
+        return TRUE;
+    gst_pad_send_event(pad, gst_event_new_new_segment_full(update, target, appliedRate,
+                                                           format, start, stop, position));
+    return FALSE;
+}
+
+GstElement *Pipeline::audioHead() const
+{
+    return m_scaletempo && GST_OBJECT_PARENT(m_scaletempo) ? m_scaletempo : m_audioPipe;
+}
+
+/*
+ * Puts scaletempo into the audio graph while the rate is not 1.0 and takes
+ * it out again once it is back to normal.
+ */
+void Pipeline::updateScaletempo()
+{
+    if (!isNormalRate(m_rate) && !m_scaletempo)
+        createScaletempo();
+    if (!m_scaletempo)
+        return;
+    const bool linked = GST_OBJECT_PARENT(m_scaletempo) != 0;
+    if (linked == !isNormalRate(m_rate))
+        return;
+    {
+        // A pending block relinks for whatever the rate is by then.
+        QMutexLocker lock(&m_positionLock);
+        if (m_scaletempoBlock)
+            return;
+    }
+
+    // Relinking has to wait until no data passes the upstream pad. The pad
+    // feeding the graph belongs to playsink unless our own queue is there.
+    GstPad *upstream = 0;
+    if (GST_STATE(m_pipeline) > GST_STATE_READY) {
+        if (m_audioQueue) {
+            upstream = gst_element_get_static_pad(m_audioQueue, "src");
+        } else {
+            GstPad *ghostPad = gst_element_get_static_pad(m_audioGraph, "sink");
+            upstream = gst_pad_get_peer(ghostPad);
+            gst_object_unref(ghostPad);
+        }
+    }
+    if (!upstream) {
+        relinkScaletempo();
+        return;
+    }
+    {
+        QMutexLocker lock(&m_positionLock);
+        m_scaletempoBlock = upstream;
+    }
+    gst_pad_set_blocked_async(upstream, TRUE, cb_scaletempoBlocked, this);
+}
+
+void Pipeline::createScaletempo()
+{
+    GstElement *scaletempo = gst_element_factory_make("scaletempo", NULL);
+    if (!scaletempo) {
+        Debug::warning() << "scaletempo is not available, the pitch will follow the playback rate";
+        return;
+    }
+    m_scaletempo = gst_bin_new("scaletempoBin");
+    gst_object_ref(GST_OBJECT(m_scaletempo));
+    gst_object_sink(GST_OBJECT(m_scaletempo));
+
+    GstElement *convertIn = gst_element_factory_make("audioconvert", NULL);
+    GstElement *convertOut = gst_element_factory_make("audioconvert", NULL);
+    gst_bin_add_many(GST_BIN(m_scaletempo), convertIn, scaletempo, convertOut, NULL);
+    gst_element_link_many(convertIn, scaletempo, convertOut, NULL);
+    GstPad *pad = gst_element_get_static_pad(convertIn, "sink");
+    gst_element_add_pad(m_scaletempo, gst_ghost_pad_new("sink", pad));
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(convertOut, "src");
+    gst_element_add_pad(m_scaletempo, gst_ghost_pad_new("src", pad));
+    gst_object_unref(pad);
+}
+
+void Pipeline::cb_scaletempoBlocked(GstPad *pad, gboolean blocked, gpointer data)
+{
+    if (!blocked)
+        return;
+    Pipeline *that = static_cast<Pipeline*>(data);
+    {
+        // reset() got here first.
+        QMutexLocker lock(&that->m_positionLock);
+        if (that->m_scaletempoBlock != pad)
+            return;
+    }
+    that->relinkScaletempo();
+    that->unblockScaletempo();
+}
+
+void Pipeline::unblockScaletempo()
+{
+    GstPad *pad;
+    {
+        QMutexLocker lock(&m_positionLock);
+        pad = m_scaletempoBlock;
+        m_scaletempoBlock = 0;
+    }
+    if (!pad)
+        return;
+    gst_pad_set_blocked_async(pad, FALSE, cb_scaletempoBlocked, this);
+    gst_object_unref(pad);
+}
+
+/*
+ * Links or unlinks scaletempo to match the current rate. The rate may have
+ * changed again, or the pipeline been reset, while the pad was blocking.
+ */
+void Pipeline::relinkScaletempo()
+{
+    double rate;
+    {
+        QMutexLocker lock(&m_positionLock);
+        rate = m_rate;
+    }
+    if (!m_scaletempo)
+        return;
+    const bool linked = GST_OBJECT_PARENT(m_scaletempo) != 0;
+    if (!isNormalRate(rate) && !linked)
+        linkScaletempo();
+    else if (isNormalRate(rate) && linked)
+        unlinkScaletempo();
+}
+
+/*
+ * Puts the scaletempo bin between the graph's sink pad (or its queue) and the
+ * audio pipe. Must not run while data flows into the pipe.
+ */
+void Pipeline::linkScaletempo()
+{
+    GstPad *pipePad = gst_element_get_static_pad(m_audioPipe, "sink");
+    GstPad *tempoSink = gst_element_get_static_pad(m_scaletempo, "sink");
+    GstPad *tempoSrc = gst_element_get_static_pad(m_scaletempo, "src");
+    gst_bin_add(GST_BIN(m_audioGraph), m_scaletempo);
+    if (m_audioQueue) {
+        GstPad *queuePad = gst_element_get_static_pad(m_audioQueue, "src");
+        gst_pad_unlink(queuePad, pipePad);
+        gst_pad_link(queuePad, tempoSink);
+        gst_object_unref(queuePad);
+    } else {
+        GstPad *ghostPad = gst_element_get_static_pad(m_audioGraph, "sink");
+        gst_ghost_pad_set_target(GST_GHOST_PAD(ghostPad), tempoSink);
+        gst_object_unref(ghostPad);
+    }
+    gst_pad_link(tempoSrc, pipePad);
+    gst_object_unref(tempoSrc);
+    gst_object_unref(tempoSink);
+    gst_object_unref(pipePad);
+    gst_element_sync_state_with_parent(m_scaletempo);
+}
+
+/*
+ * The reverse of linkScaletempo(), with the same restrictions.
+ */
+void Pipeline::unlinkScaletempo()
+{
+    GstPad *pipePad = gst_element_get_static_pad(m_audioPipe, "sink");
+    GstPad *tempoSink = gst_element_get_static_pad(m_scaletempo, "sink");
+    GstPad *tempoSrc = gst_element_get_static_pad(m_scaletempo, "src");
+    gst_pad_unlink(tempoSrc, pipePad);
+    if (m_audioQueue) {
+        GstPad *queuePad = gst_element_get_static_pad(m_audioQueue, "src");
+        gst_pad_unlink(queuePad, tempoSink);
+        gst_pad_link(queuePad, pipePad);
+        gst_object_unref(queuePad);
+    } else {
+        GstPad *ghostPad = gst_element_get_static_pad(m_audioGraph, "sink");
+        gst_ghost_pad_set_target(GST_GHOST_PAD(ghostPad), pipePad);
+        gst_object_unref(ghostPad);
+    }
+    gst_object_unref(tempoSrc);
+    gst_object_unref(tempoSink);
+    gst_object_unref(pipePad);
+    // Our own reference keeps the bin around for the next rate change.
+    gst_element_set_state(m_scaletempo, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(m_audioGraph), m_scaletempo);
+}
+
+/*
+ * Only call this while the pipeline is at most READY.
+ */
+void Pipeline::removeScaletempo()
+{
+    if (!m_scaletempo)
+        return;
+    if (GST_OBJECT_PARENT(m_scaletempo) == GST_OBJECT(m_audioGraph))
+        unlinkScaletempo();
+    gst_object_unref(m_scaletempo);
+    m_scaletempo = 0;
 }
 
 bool Pipeline::isSeekable() const
+{
+    QMutexLocker lock(&m_capabilitiesLock);
+    if (updateCapabilities())
+        return m_seekable;
+    return querySeekable();
+}
+
+bool Pipeline::querySeekable() const
 {
     gboolean seekable = 0;
     GstQuery *query;
@@ -800,20 +1783,50 @@ static void cb_feedAppSrc(GstAppSrc *appSrc, guint buffsize, gpointer data)
 {
     DEBUG_BLOCK;
     StreamReader *reader = static_cast<StreamReader*>(data);
+    if (reader->isMapped()) {
+        // Points straight into the file mapping, nothing gets copied.
+        GstBuffer *buf = reader->mappedBuffer(buffsize);
+        if (buf)
+            gst_app_src_push_buffer(appSrc, buf);
+        else
+            gst_app_src_end_of_stream(appSrc);
+        return;
+    }
     GstBuffer *buf = gst_buffer_new_and_alloc(buffsize);
-#warning ret not used!!! WHOOPWHOOPWHOOP
-    reader->read(reader->currentPos(), buffsize, (char*)GST_BUFFER_DATA(buf));
-    gst_app_src_push_buffer(appSrc, buf);
-    if (GST_BUFFER_SIZE(buf) > 0 && reader->atEnd())
+    int length = buffsize;
+    if (reader->read(reader->currentPos(), &length, (char*)GST_BUFFER_DATA(buf)) != GST_FLOW_OK) {
+        gst_buffer_unref(buf);
         gst_app_src_end_of_stream(appSrc);
+        return;
+    }
+    // A short buffer is the tail, the next call finds nothing and ends the stream.
+    GST_BUFFER_SIZE(buf) = length;
+    gst_app_src_push_buffer(appSrc, buf);
 }
 
-static void cb_seekAppSrc(GstAppSrc *appSrc, guint64 pos, gpointer data)
+static gboolean cb_seekAppSrc(GstAppSrc *appSrc, guint64 pos, gpointer data)
 {
     Q_UNUSED(appSrc);
     DEBUG_BLOCK;
     StreamReader *reader = static_cast<StreamReader*>(data);
     reader->setCurrentPos(pos);
+    return TRUE;
+}
+
+// Zero-copy feeding: the reader pushes on its own, appsrc only tells it when to go.
+static void cb_requestAppSrcData(GstAppSrc *appSrc, guint buffsize, gpointer data)
+{
+    Q_UNUSED(appSrc);
+    Q_UNUSED(buffsize);
+    StreamReader *reader = static_cast<StreamReader*>(data);
+    reader->requestData();
+}
+
+static void cb_enoughAppSrcData(GstAppSrc *appSrc, gpointer data)
+{
+    Q_UNUSED(appSrc);
+    StreamReader *reader = static_cast<StreamReader*>(data);
+    reader->pauseData();
 }
 
 void Pipeline::cb_setupSource(GstElement *playbin, GParamSpec *param, gpointer data)
@@ -837,17 +1850,26 @@ void Pipeline::cb_setupSource(GstElement *playbin, GParamSpec *param, gpointer d
 
     if (that->m_isStream) {
         that->m_reader = new StreamReader(that->m_currentSource, that);
+        if (that->m_reader->isZeroCopy())
+            that->m_reader->pushTo(GST_APP_SRC(phononSrc));
         that->m_reader->start();
         if (that->m_reader->streamSize() > 0)
             g_object_set(phononSrc, "size", that->m_reader->streamSize(), NULL);
         int streamType = 0;
-        if (that->m_reader->streamSeekable())
+        if (that->m_reader->isMapped())
+            streamType = GST_APP_STREAM_TYPE_RANDOM_ACCESS;
+        else if (that->m_reader->streamSeekable())
             streamType = GST_APP_STREAM_TYPE_SEEKABLE;
         else
             streamType = GST_APP_STREAM_TYPE_STREAM;
         g_object_set(phononSrc, "stream-type", streamType, NULL);
-        g_object_set(phononSrc, "block", TRUE, NULL);
-        g_signal_connect(phononSrc, "need-data", G_CALLBACK(cb_feedAppSrc), that->m_reader);
+        if (that->m_reader->isZeroCopy()) {
+            g_signal_connect(phononSrc, "need-data", G_CALLBACK(cb_requestAppSrcData), that->m_reader);
+            g_signal_connect(phononSrc, "enough-data", G_CALLBACK(cb_enoughAppSrcData), that->m_reader);
+        } else {
+            g_object_set(phononSrc, "block", TRUE, NULL);
+            g_signal_connect(phononSrc, "need-data", G_CALLBACK(cb_feedAppSrc), that->m_reader);
+        }
         g_signal_connect(phononSrc, "seek-data", G_CALLBACK(cb_seekAppSrc), that->m_reader);
     } else {
         if (that->currentSource().type() == MediaSource::Url
@@ -867,6 +1889,84 @@ void Pipeline::cb_setupSource(GstElement *playbin, GParamSpec *param, gpointer d
     gst_object_unref(that->m_pipeline);
 }
 
+/*
+ * Keeps track of the running time at which audio enters the audio graph. When
+ * a new segment starts without a flush, i.e. playbin2 moved on to the next
+ * stream, the distance between the end of the last buffer and the start of the
+ * first new one is the gap heard between the two tracks.
+ */
+gboolean Pipeline::cb_audioProbe(GstPad *pad, GstMiniObject *object, gpointer data)
+{
+    Q_UNUSED(pad);
+    Pipeline *that = static_cast<Pipeline*>(data);
+
+    if (that->m_resetAudioProbe.fetchAndStoreOrdered(0)) {
+        gst_segment_init(&that->m_audioSegment, GST_FORMAT_TIME);
+        that->m_audioEnd = GST_CLOCK_TIME_NONE;
+        that->m_measureGap = false;
+    }
+
+    if (GST_IS_EVENT(object)) {
+        GstEvent *event = GST_EVENT(object);
+        switch (GST_EVENT_TYPE(event)) {
+        case GST_EVENT_FLUSH_STOP:
+            // Seeks restart the running time, there is no transition to measure.
+            gst_segment_init(&that->m_audioSegment, GST_FORMAT_TIME);
+            that->m_audioEnd = GST_CLOCK_TIME_NONE;
+            that->m_measureGap = false;
+            break;
+        case GST_EVENT_NEWSEGMENT: {
+            gboolean update;
+            gdouble rate, appliedRate;
+            GstFormat format;
+            gint64 start, stop, position;
+            gst_event_parse_new_segment_full(event, &update, &rate, &appliedRate,
+                                             &format, &start, &stop, &position);
+            if (format != GST_FORMAT_TIME)
+                break;
+            gst_segment_set_newsegment_full(&that->m_audioSegment, update, rate, appliedRate,
+                                            format, start, stop, position);
+            if (!update)
+                that->m_measureGap = GST_CLOCK_TIME_IS_VALID(that->m_audioEnd);
+            break;
+        }
+        default:
+            break;
+        }
+        return TRUE;
+    }
+
+    GstBuffer *buffer = GST_BUFFER(object);
+    if (!GST_BUFFER_TIMESTAMP_IS_VALID(buffer) || that->m_audioSegment.format != GST_FORMAT_TIME)
+        return TRUE;
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP(buffer);
+    const GstClockTime start = gst_segment_to_running_time(&that->m_audioSegment, GST_FORMAT_TIME, timestamp);
+    if (!GST_CLOCK_TIME_IS_VALID(start))
+        return TRUE;
+
+    if (that->m_measureGap) {
+        that->m_measureGap = false;
+        gint rate = 0;
+        if (GST_BUFFER_CAPS(buffer))
+            gst_structure_get_int(gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0), "rate", &rate);
+        // Negative if the tracks overlap.
+        const GstClockTimeDiff gap = GST_CLOCK_DIFF(that->m_audioEnd, start);
+        const int samples = gap * rate / GST_SECOND;
+        that->m_transitionGap.fetchAndStoreOrdered(samples);
+        debug() << "Gap between streams:" << samples << "samples," << gap / GST_USECOND << "us";
+    }
+
+    if (GST_BUFFER_DURATION_IS_VALID(buffer))
+        timestamp += GST_BUFFER_DURATION(buffer);
+    that->m_audioEnd = gst_segment_to_running_time(&that->m_audioSegment, GST_FORMAT_TIME, timestamp);
+    return TRUE;
+}
+
+int Pipeline::transitionGap() const
+{
+    return m_transitionGap;
+}
+
 void Pipeline::cb_aboutToFinish(GstElement *appSrc, gpointer data)
 {
     Q_UNUSED(appSrc);
@@ -879,16 +1979,72 @@ Phonon::MediaSource Pipeline::currentSource() const
     return m_currentSource;
 }
 
+qint64 Pipeline::queuedTime() const
+{
+    return audioQueueLevel().time / GST_MSECOND;
+}
+
 qint64 Pipeline::position() const
 {
     gint64 pos = 0;
     GstFormat format = GST_FORMAT_TIME;
     if (m_resetting)
         return m_posAtReset;
-    gst_element_query_position (GST_ELEMENT(m_pipeline), &format, &pos);
+    // Report where we are going, not the stale position of the old segment.
+    // A seek that never completes must not freeze the position though.
+    if (m_seekInFlight && m_seekTime.elapsed() < SEEK_TIMEOUT)
+        return m_pendingSeek >= 0 ? m_pendingSeek : m_seekTarget;
+
+    if (!m_interpolatePosition) {
+        gst_element_query_position (GST_ELEMENT(m_pipeline), &format, &pos);
+        return (pos / GST_MSECOND);
+    }
+
+    // A position query walks the whole bin down to the sinks. While nothing
+    // disturbs playback, the position advances exactly like the running time
+    // of the pipeline clock, so we query once and extrapolate from there.
+    // State changes, seeks, buffering and stream changes drop the anchor.
+    QMutexLocker lock(&m_positionLock);
+    const bool playing = GST_STATE(m_pipeline) == GST_STATE_PLAYING
+            && GST_STATE_PENDING(m_pipeline) == GST_STATE_VOID_PENDING;
+    if (m_positionValid && m_positionPlaying == playing) {
+        if (!playing)
+            return m_positionAnchor / GST_MSECOND;
+        const GstClockTime running = runningTime();
+        if (GST_CLOCK_TIME_IS_VALID(running) && running >= m_runningAnchor)
+            return (m_positionAnchor + qint64((running - m_runningAnchor) * m_rate)) / GST_MSECOND;
+    }
+
+    if (!gst_element_query_position(GST_ELEMENT(m_pipeline), &format, &pos)) {
+        m_positionValid = false;
+        return (pos / GST_MSECOND);
+    }
+    m_positionAnchor = pos;
+    m_positionPlaying = playing;
+    m_runningAnchor = playing ? runningTime() : GST_CLOCK_TIME_NONE;
+    m_positionValid = !playing || GST_CLOCK_TIME_IS_VALID(m_runningAnchor);
     return (pos / GST_MSECOND);
 }
 
+GstClockTime Pipeline::runningTime() const
+{
+    GstClock *clock = gst_element_get_clock(GST_ELEMENT(m_pipeline));
+    if (!clock)
+        return GST_CLOCK_TIME_NONE;
+    const GstClockTime now = gst_clock_get_time(clock);
+    const GstClockTime base = gst_element_get_base_time(GST_ELEMENT(m_pipeline));
+    gst_object_unref(clock);
+    if (!GST_CLOCK_TIME_IS_VALID(now) || now < base)
+        return GST_CLOCK_TIME_NONE;
+    return now - base;
+}
+
+void Pipeline::invalidatePosition()
+{
+    QMutexLocker lock(&m_positionLock);
+    m_positionValid = false;
+}
+
 QByteArray Pipeline::captureDeviceURI(const MediaSource &source) const
 {
 #ifndef PHONON_NO_AUDIOCAPTURE
@@ -18,11 +18,15 @@
 #ifndef Phonon_GSTREAMER_PIPELINE_H
 #define Phonon_GSTREAMER_PIPELINE_H
 
+#include "downloadcache.h"
 #include "plugininstaller.h"
+#include "queuepolicy.h"
 #include <gst/gst.h>
 #include <phonon/MediaSource>
 #include <phonon/MediaController>
+#include <QtCore/QAtomicInt>
 #include <QtCore/QMutex>
+#include <QtCore/QTime>
 
 typedef QMultiMap<QString, QString> TagMap;
 
@@ -40,6 +44,15 @@ class Pipeline : public QObject
     Q_OBJECT
 
     public:
+        // Trade-off between speed and precision of user seeks, see seekToMSec()
+        enum SeekMode {
+            DefaultSeek,    // whatever the demuxer does by default
+            KeyframeSeek,   // nearest keyframe, cheapest
+            SnapBeforeSeek, // keyframe at or before the target
+            SnapAfterSeek,  // keyframe at or after the target
+            AccurateSeek    // exactly the target, decodes from the previous keyframe
+        };
+
         Pipeline(QObject *parent = 0);
         virtual ~Pipeline();
         GstElement *element() const;
@@ -54,6 +67,7 @@ class Pipeline : public QObject
         bool queryDuration(GstFormat *format, gint64 *duration) const;
         qint64 totalDuration() const;
 
+        static GstBusSyncReply cb_busSync(GstBus *bus, GstMessage *msg, gpointer data);
         static gboolean cb_eos(GstBus *bus, GstMessage *msg, gpointer data);
         static gboolean cb_warning(GstBus *bus, GstMessage *msg, gpointer data);
         static gboolean cb_duration(GstBus *bus, GstMessage *msg, gpointer data);
@@ -62,11 +76,29 @@ class Pipeline : public QObject
         static gboolean cb_element(GstBus *bus, GstMessage *msg, gpointer data);
         static gboolean cb_error(GstBus *bus, GstMessage *msg, gpointer data);
         static gboolean cb_tag(GstBus *bus, GstMessage *msg, gpointer data);
+        static gboolean cb_asyncDone(GstBus *bus, GstMessage *msg, gpointer data);
 
         static void cb_aboutToFinish(GstElement *appSrc, gpointer data);
+        static void cb_downloadStarted(GstObject *pipeline, GstObject *object, GParamSpec *param, gpointer data);
+        static gboolean cb_audioProbe(GstPad *pad, GstMiniObject *object, gpointer data);
         static void cb_endOfPads(GstElement *playbin, gpointer data);
+        static void cb_scaletempoBlocked(GstPad *pad, gboolean blocked, gpointer data);
+        static gboolean cb_segmentProbe(GstPad *pad, GstEvent *event, gpointer data);
+        static void cb_queueShareChanged(gpointer data);
 
         void setSource(const Phonon::MediaSource &source, bool reset = false);
+        // Replaces the source of a running pipeline without reporting the
+        // reset, playback continues at the start of it.
+        void switchSource(const Phonon::MediaSource &source);
+        // Queues the source playbin2 continues with, see cb_aboutToFinish().
+        // Safe to call from a streaming thread.
+        bool setNextSource(const Phonon::MediaSource &source);
+        // Does the file system work for a later setNextSource() of source
+        // up front, on the main thread.
+        void prepareNextSource(const Phonon::MediaSource &source);
+        // Brings the pipeline back to its freshly constructed state, so it can
+        // be handed to another MediaObject.
+        void reset();
 
         static void cb_videoChanged(GstElement *playbin, gpointer data);
         static void cb_textTagsChanged(GstElement *playbin, gint stream, gpointer data);
@@ -88,13 +120,31 @@ class Pipeline : public QObject
         void updateNavigation();
 
         bool seekToMSec(qint64 time);
+        SeekMode seekMode() const;
+        void setSeekMode(SeekMode mode);
         bool isSeekable() const;
+        // Playback speed factor, 1.0 is normal speed. Audio keeps its pitch
+        // as long as the scaletempo element is available.
+        double playbackRate() const;
+        bool setPlaybackRate(double rate);
 
         Phonon::State phononState() const;
         static void cb_setupSource(GstElement *playbin, GParamSpec *spec, gpointer data);
 
         qint64 position() const;
+        // Forces the next position() to query the pipeline again.
+        void invalidatePosition();
+        // Amount of audio (in msec) buffered ahead of the sinks.
+        qint64 queuedTime() const;
+        // Samples of silence between the last two streams, negative if they
+        // overlapped.
+        int transitionGap() const;
+        // Current fill of the queues in front of the sink graphs, zero if the
+        // source runs without them.
+        QueueSize audioQueueLevel() const;
+        QueueSize videoQueueLevel() const;
         QByteArray captureDeviceURI(const MediaSource &source) const;
+        QByteArray sourceUri(const Phonon::MediaSource &source);
 
     signals:
         void windowIDNeeded();
@@ -118,6 +168,7 @@ class Pipeline : public QObject
 
     private:
         GstPipeline *m_pipeline;
+        guint m_defaultFlags;
         int m_bufferPercent;
 
         // Keeps track of whether or not we jump to GST_STATE_PLAYING after plugin installtion is finished.
@@ -130,19 +181,113 @@ class Pipeline : public QObject
         QMultiMap<QString, QString> m_metaData;
         QList<MediaController::NavigationMenu> m_menus;
         Phonon::MediaSource m_currentSource;
+        void beginSource(const Phonon::MediaSource &source);
+        void loadSource(const Phonon::MediaSource &source, bool reset, qint64 resumeAt);
+        // Handed over by setNextSource(), waiting for commitNextSource()
+        Phonon::MediaSource m_nextSource;
+        QMutex m_nextSourceLock;
         PluginInstaller *m_installer;
         StreamReader *m_reader;
         GstElement *m_audioGraph;
         GstElement *m_videoGraph;
         GstElement *m_audioPipe;
         GstElement *m_videoPipe;
+        // Only present for streaming sources, see setQueuing()
+        GstElement *m_audioQueue;
+        GstElement *m_videoQueue;
+        QueuePolicy m_queuePolicy;
+        void setQueuing(bool enable);
+        void applyQueueLimits();
 
         bool m_seeking;
         bool m_resetting;
         qint64 m_posAtReset;
+        // State to return to once the seek after a reset has completed
+        GstState m_stateAfterReset;
+        void restoreStateAfterReset();
         QMutex m_tagLock;
 
+        // Whether bus messages are handled from the Qt event loop rather than
+        // synchronously on the streaming threads, see cb_busSync().
+        bool m_asyncBus;
+        QAtomicInt m_busScheduled;
+        // Bumped by reset(), see invokeLater()
+        void invokeLater(const char *method);
+        QAtomicInt m_generation;
+
+        // Position cache, see position()
+        GstClockTime runningTime() const;
+        bool m_interpolatePosition;
+        mutable QMutex m_positionLock;
+        mutable bool m_positionValid;
+        mutable bool m_positionPlaying;
+        mutable gint64 m_positionAnchor;
+        mutable GstClockTime m_runningAnchor;
+
+        // Capability cache, see updateCapabilities()
+        bool updateCapabilities() const;
+        void invalidateCapabilities();
+        qint64 queryTotalDuration() const;
+        bool querySeekable() const;
+        mutable QMutex m_capabilitiesLock;
+        mutable bool m_capabilitiesValid;
+        mutable bool m_seekable;
+        mutable qint64 m_duration;
+
+        // Transition gap measurement, only touched from cb_audioProbe()
+        GstSegment m_audioSegment;
+        GstClockTime m_audioEnd;
+        bool m_measureGap;
+        QAtomicInt m_resetAudioProbe;
+        QAtomicInt m_transitionGap;
+
+        // Progressive download of http sources, see setupDownload()
+        QByteArray setupDownload(const QUrl &url, const QByteArray &gstUri, bool isHttpUrl, bool prepared);
+        void checkDownload();
+        DownloadCache m_downloadCache;
+        QMutex m_downloadLock;
+        GstElement *m_downloadQueue;
+        QString m_downloadFile;
+        QUrl m_downloadUrl;
+        // Cache lookup done by prepareNextSource()
+        QUrl m_preparedUrl;
+        QString m_preparedFile;
+
+        // Seek coalescing, see seekTo()
+        bool seekTo(qint64 time, SeekMode mode);
+        bool issueSeek(qint64 time, SeekMode mode);
+        SeekMode m_seekMode;
+        bool m_seekInFlight;
+        qint64 m_seekTarget;
+        qint64 m_pendingSeek;
+        SeekMode m_pendingSeekMode;
+        QTime m_seekTime;
+        // Bumped for every seek, m_asyncDoneSerial holds its value as of the
+        // last ASYNC_DONE posted, see seekCompleted().
+        QAtomicInt m_seekSerial;
+        QAtomicInt m_asyncDoneSerial;
+
+        // Rate changes, see setPlaybackRate()
+        GstElement *audioHead() const;
+        void updateScaletempo();
+        void createScaletempo();
+        void relinkScaletempo();
+        void linkScaletempo();
+        void unlinkScaletempo();
+        void removeScaletempo();
+        double m_rate;
+        // audioconvert ! scaletempo ! audioconvert between the audio queue
+        // and the audio pipe, only linked while the rate is not 1.0
+        GstElement *m_scaletempo;
+        // Pad blocked by updateScaletempo() until cb_scaletempoBlocked() has
+        // relinked, guarded by m_positionLock
+        GstPad *m_scaletempoBlock;
+        void unblockScaletempo();
+
     private Q_SLOTS:
+        void processBusMessages(int generation);
+        void commitNextSource(int generation);
+        void seekCompleted(int generation);
         void pluginInstallFailure(const QString &msg);
         void pluginInstallComplete();
         void pluginInstallStarted();
@@ -0,0 +1,150 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "queuepolicy.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+
+// Default for PHONON_GST_QUEUE_BUDGET
+#define DEFAULT_QUEUE_BUDGET (64 * 1024 * 1024)
+// No single pipeline gets less than this, however many there are.
+#define MIN_QUEUE_SHARE (2 * 1024 * 1024)
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+// Policies that currently have queues, sharing the budget.
+static QMutex s_queueUsersLock;
+static QList<QueuePolicy *> s_queueUsers;
+
+QueuePolicy::QueuePolicy(ShareChanged callback, gpointer data)
+    : m_type(LocalSource)
+    , m_bitrate(0)
+    , m_shareChanged(callback)
+    , m_shareChangedData(data)
+{
+}
+
+QueuePolicy::~QueuePolicy()
+{
+    setType(LocalSource);
+}
+
+QueuePolicy::SourceType QueuePolicy::sourceType(const MediaSource &source)
+{
+    switch (source.type()) {
+    case MediaSource::Url:
+        if (source.mrl().scheme() == QLatin1String("file"))
+            return LocalSource;
+        return NetworkSource;
+    case MediaSource::Stream:
+        return StreamSource;
+    case MediaSource::CaptureDevice:
+        return CaptureSource;
+    default:
+        return LocalSource;
+    }
+}
+
+void QueuePolicy::setType(SourceType type)
+{
+    const bool wasQueuing = needsQueue();
+    m_type = type;
+    if (wasQueuing == needsQueue())
+        return;
+
+    QList<QueuePolicy *> others;
+    {
+        QMutexLocker lock(&s_queueUsersLock);
+        if (wasQueuing)
+            s_queueUsers.removeOne(this);
+        else
+            s_queueUsers.append(this);
+        others = s_queueUsers;
+    }
+    // Everybody else's share just changed.
+    others.removeOne(this);
+    foreach (QueuePolicy *other, others) {
+        if (other->m_shareChanged)
+            other->m_shareChanged(other->m_shareChangedData);
+    }
+}
+
+void QueuePolicy::setBitrate(int bitrate)
+{
+    m_bitrate = qMax(0, bitrate);
+}
+
+quint64 QueuePolicy::budget()
+{
+    static const quint64 budget = qgetenv("PHONON_GST_QUEUE_BUDGET").isEmpty()
+            ? DEFAULT_QUEUE_BUDGET : qgetenv("PHONON_GST_QUEUE_BUDGET").toULongLong() * 1024;
+    return budget;
+}
+
+quint64 QueuePolicy::share() const
+{
+    QMutexLocker lock(&s_queueUsersLock);
+    const int users = qMax(1, s_queueUsers.size());
+    return qMax<quint64>(budget() / users, MIN_QUEUE_SHARE);
+}
+
+guint64 QueuePolicy::bufferTime() const
+{
+    switch (m_type) {
+    case NetworkSource:
+        // Cheap, low bitrate streams (internet radio) get more slack.
+        if (m_bitrate > 0 && m_bitrate <= 320000)
+            return 20 * GST_SECOND;
+        return 10 * GST_SECOND;
+    case StreamSource:
+        return 5 * GST_SECOND;
+    case CaptureSource:
+        return GST_SECOND;
+    case LocalSource:
+        break;
+    }
+    return 0;
+}
+
+QueueSize QueuePolicy::audioLimits() const
+{
+    // Overruns are handled badly on that platform, so it gets a single buffer
+    // and no other limit.
+    if (!qgetenv("TEGRA_GST_OPENMAX").isEmpty())
+        return QueueSize(0, 0, 1);
+    // Decoded audio is small next to video, a quarter of the share is plenty.
+    return QueueSize(bufferTime(), share() / 4, 0);
+}
+
+QueueSize QueuePolicy::videoLimits() const
+{
+    // Decoded frames are large, so for video the bytes are what really binds.
+    return QueueSize(qMin<guint64>(bufferTime(), 2 * GST_SECOND), share() * 3 / 4, 0);
+}
+
+int QueuePolicy::networkBufferSize() const
+{
+    if (m_type != NetworkSource || m_bitrate <= 0)
+        return -1;
+    const quint64 size = quint64(m_bitrate) / 8 * bufferTime() / GST_SECOND;
+    return qMin<quint64>(size, share() / 2);
+}
+
+}
+}
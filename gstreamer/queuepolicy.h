@@ -0,0 +1,97 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_QUEUEPOLICY_H
+#define PHONON_GSTREAMER_QUEUEPOLICY_H
+
+#include <gst/gst.h>
+#include <phonon/MediaSource>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Limits or fill level of a queue element, 0 meaning unlimited for limits.
+ */
+struct QueueSize
+{
+    QueueSize(guint64 t = 0, guint b = 0, guint n = 0) : time(t), bytes(b), buffers(n) {}
+    guint64 time;
+    guint bytes;
+    guint buffers;
+};
+
+/**
+ * Decides how much a Pipeline buffers in front of its sink graphs.
+ *
+ * The time to cover depends on the kind of source: capture devices want low
+ * latency, network streams want to ride out jitter. The bytes are bounded by
+ * a share of a process wide budget (PHONON_GST_QUEUE_BUDGET, in KiB), split
+ * between all pipelines that currently queue. Whenever one starts or stops
+ * queuing, the others are told through their callback to re-apply their
+ * limits. The encoded bitrate sizes the network buffer playbin2 keeps before
+ * decoding.
+ */
+class QueuePolicy
+{
+public:
+    enum SourceType {
+        LocalSource,
+        NetworkSource,
+        CaptureSource,
+        StreamSource
+    };
+
+    /// Called when the share of the budget changed because of another policy.
+    typedef void (*ShareChanged)(gpointer data);
+
+    explicit QueuePolicy(ShareChanged callback = 0, gpointer data = 0);
+    ~QueuePolicy();
+
+    static SourceType sourceType(const MediaSource &source);
+
+    SourceType type() const { return m_type; }
+    void setType(SourceType type);
+    /// Local sources are pulled on demand and run without queues.
+    bool needsQueue() const { return m_type != LocalSource; }
+
+    /// Encoded bitrate of the current stream in bit/s, 0 if unknown.
+    int bitrate() const { return m_bitrate; }
+    void setBitrate(int bitrate);
+
+    QueueSize audioLimits() const;
+    QueueSize videoLimits() const;
+    /// Size in bytes of playbin2's network buffer, -1 for its default.
+    int networkBufferSize() const;
+
+    /// Bytes all queues of the process may hold together.
+    static quint64 budget();
+
+private:
+    quint64 share() const;
+    guint64 bufferTime() const;
+
+    SourceType m_type;
+    int m_bitrate;
+    ShareChanged m_shareChanged;
+    gpointer m_shareChangedData;
+};
+
+}
+}
+
+#endif // PHONON_GSTREAMER_QUEUEPOLICY_H
@@ -0,0 +1,102 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ringbuffer.h"
+
+#include <QtCore/QtGlobal>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+RingBuffer::RingBuffer(int capacity)
+    : m_head(0)
+    , m_size(0)
+{
+    m_data.resize(capacity);
+}
+
+void RingBuffer::setCapacity(int capacity)
+{
+    if (capacity < m_size)
+        capacity = m_size;
+    if (capacity == this->capacity())
+        return;
+
+    // Linearize the buffered data into the new store.
+    QByteArray data(capacity, Qt::Uninitialized);
+    peek(data.data(), m_size);
+    m_data = data;
+    m_head = 0;
+}
+
+void RingBuffer::clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
+
+int RingBuffer::write(const char *data, int length)
+{
+    // The capacity is a hard bound, whatever does not fit is refused.
+    length = qMin(length, freeSpace());
+    if (length <= 0)
+        return 0;
+
+    int tail = (m_head + m_size) % capacity();
+    int chunk = qMin(length, capacity() - tail);
+    qMemCopy(m_data.data() + tail, data, chunk);
+    if (chunk < length)
+        qMemCopy(m_data.data(), data + chunk, length - chunk);
+    m_size += length;
+    return length;
+}
+
+int RingBuffer::peek(char *data, int length, int offset) const
+{
+    if (offset >= m_size)
+        return 0;
+    length = qMin(length, m_size - offset);
+    if (length <= 0)
+        return 0;
+
+    int start = (m_head + offset) % capacity();
+    int chunk = qMin(length, capacity() - start);
+    qMemCopy(data, m_data.constData() + start, chunk);
+    if (chunk < length)
+        qMemCopy(data + chunk, m_data.constData(), length - chunk);
+    return length;
+}
+
+int RingBuffer::read(char *data, int length)
+{
+    length = peek(data, length);
+    skip(length);
+    return length;
+}
+
+int RingBuffer::skip(int length)
+{
+    length = qMin(length, m_size);
+    if (length <= 0)
+        return 0;
+    m_size -= length;
+    m_head = m_size ? (m_head + length) % capacity() : 0;
+    return length;
+}
+
+}
+}
@@ -0,0 +1,66 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_RINGBUFFER_H
+#define PHONON_GSTREAMER_RINGBUFFER_H
+
+#include <QtCore/QByteArray>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Byte FIFO on top of a fixed block of memory.
+ *
+ * Reads and writes cost O(length) regardless of how much data is buffered,
+ * as opposed to QByteArray::mid() which copies the whole remainder.
+ * The buffer is not thread safe, users need to do their own locking.
+ */
+class RingBuffer
+{
+public:
+    explicit RingBuffer(int capacity = 0);
+
+    int capacity() const { return m_data.size(); }
+    int size() const { return m_size; }
+    int freeSpace() const { return capacity() - m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    /// Resizes the backing store, buffered data is preserved.
+    void setCapacity(int capacity);
+    void clear();
+
+    /// Appends up to length bytes, never beyond capacity(). Returns how
+    /// many were taken.
+    int write(const char *data, int length);
+    /// Copies up to length bytes into data and consumes them.
+    int read(char *data, int length);
+    /// Copies up to length bytes starting at offset without consuming them.
+    int peek(char *data, int length, int offset = 0) const;
+    /// Consumes up to length bytes without copying them.
+    int skip(int length);
+
+private:
+    QByteArray m_data;
+    int m_head;
+    int m_size;
+};
+
+}
+}
+
+#endif // PHONON_GSTREAMER_RINGBUFFER_H
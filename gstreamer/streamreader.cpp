@@ -19,7 +19,37 @@
 #include "streamreader.h"
 
 #include "debug.h"
+
+#include <phonon/abstractmediastream.h>
+
+#include <QtCore/QFile>
+#include <QtCore/QTime>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
 #ifndef QT_NO_PHONON_ABSTRACTMEDIASTREAM
+
+// Default capacity of the read buffer, can be overridden through
+// PHONON_GST_STREAM_BUFFER (in KiB).
+#define DEFAULT_STREAM_BUFFER (4 * 1024 * 1024)
+// Memory cap of the seek cache, can be overridden through
+// PHONON_GST_STREAM_CACHE (in KiB, 0 disables the cache).
+#define DEFAULT_STREAM_CACHE (8 * 1024 * 1024)
+#define STREAM_CACHE_BLOCK (64 * 1024)
+
+static void cb_freeByteArray(gpointer data)
+{
+    delete static_cast<QByteArray *>(data);
+}
+
+// Destroying the file drops its mappings.
+static void cb_freeMappedFile(gpointer data)
+{
+    delete static_cast<QFile *>(data);
+}
+
 namespace Phonon
 {
 namespace Gstreamer
@@ -27,18 +57,55 @@ namespace Gstreamer
 
 StreamReader::StreamReader(const Phonon::MediaSource &source, Pipeline *parent)
     : m_pos(0)
+    , m_streamPos(0)
     , m_size(0)
     , m_eos(false)
     , m_locked(false)
     , m_seekable(false)
     , m_pipeline(parent)
+    , m_capacity(0)
+    , m_lowWatermark(0)
+    , m_highWatermark(0)
+    , m_readAhead(0)
+    , m_stallCount(0)
+    , m_stallTime(0)
+    , m_maxStallTime(0)
+    , m_cache(STREAM_CACHE_BLOCK, qgetenv("PHONON_GST_STREAM_CACHE").isEmpty()
+              ? DEFAULT_STREAM_CACHE : qgetenv("PHONON_GST_STREAM_CACHE").toInt() * 1024)
+    , m_cacheHits(0)
+    , m_cacheMisses(0)
+    , m_seeks(0)
+    , m_enoughData(false)
+    , m_overflowed(false)
+    , m_requested(false)
+    , m_zeroCopy(qgetenv("PHONON_GST_STREAM_ZEROCOPY").toInt())
+    , m_appSrc(0)
+    , m_mapping(0)
 {
+    int capacity = qgetenv("PHONON_GST_STREAM_BUFFER").toInt() * 1024;
+    if (capacity <= 0)
+        capacity = DEFAULT_STREAM_BUFFER;
+    // In zero-copy mode the appsrc queue takes the place of our buffer.
+    m_capacity = m_zeroCopy ? 0 : capacity;
+    m_buffer.setCapacity(m_capacity);
+    m_highWatermark = capacity;
+    if (!m_zeroCopy)
+        updateWatermarks();
     connectToSource(source);
+    if (mapFile(source)) {
+        m_capacity = 0;
+        m_buffer.setCapacity(0);
+        m_cache.clear();
+    }
 }
 
 StreamReader::~StreamReader()
 {
     DEBUG_BLOCK;
+    if (m_appSrc)
+        gst_object_unref(m_appSrc);
+    if (m_mapping)
+        gst_buffer_unref(m_mapping);
 }
 
 //------------------------------------------------------------------------------
@@ -65,12 +132,52 @@ qint64 StreamReader::streamSize() const
     return m_size;
 }
 
+int StreamReader::stallCount() const
+{
+    return m_stallCount;
+}
+
+qint64 StreamReader::stallTime() const
+{
+    return m_stallTime;
+}
+
+qint64 StreamReader::maxStallTime() const
+{
+    return m_maxStallTime;
+}
+
+int StreamReader::cacheHits() const
+{
+    return m_cacheHits;
+}
+
+int StreamReader::cacheMisses() const
+{
+    return m_cacheMisses;
+}
+
+int StreamReader::seeksIssued() const
+{
+    return m_seeks;
+}
+
 #warning convert to streamtype query
 bool StreamReader::streamSeekable() const
 {
     return m_seekable;
 }
 
+bool StreamReader::isZeroCopy() const
+{
+    return m_zeroCopy && !m_mapping;
+}
+
+bool StreamReader::isMapped() const
+{
+    return m_mapping;
+}
+
 //------------------------------------------------------------------------------
 // Explicit thread safe through locking the mutex ------------------------------
 //------------------------------------------------------------------------------
@@ -79,19 +186,72 @@ void StreamReader::setCurrentPos(qint64 pos)
 {
     QMutexLocker locker(&m_mutex);
     m_pos = pos;
-    seekStream(pos);
-    m_buffer.clear();
+    // When pulling, the seek is deferred to read(), which may not need it at all.
+    if (m_appSrc)
+        seekStreamTo(pos);
 }
 
 void StreamReader::writeData(const QByteArray &data)
 {
     QMutexLocker locker(&m_mutex);
     Debug::Block block(__PRETTY_FUNCTION__);
-    m_buffer.append(data);
+    if (m_appSrc) {
+        if (!m_locked || data.isEmpty())
+            return;
+        // Keep a shallow copy alive for as long as GStreamer holds the buffer.
+        QByteArray *chunk = new QByteArray(data);
+        GstBuffer *buffer = gst_buffer_new();
+        GST_BUFFER_DATA(buffer) = reinterpret_cast<guint8 *>(const_cast<char *>(chunk->constData()));
+        GST_BUFFER_SIZE(buffer) = chunk->size();
+        GST_BUFFER_OFFSET(buffer) = m_pos;
+        GST_BUFFER_MALLOCDATA(buffer) = reinterpret_cast<guint8 *>(chunk);
+        GST_BUFFER_FREE_FUNC(buffer) = cb_freeByteArray;
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_READONLY);
+        m_pos += chunk->size();
+        m_streamPos = m_pos;
+        // appsrc may call enough-data from within the push, which ends up in
+        // pauseData() and takes m_mutex again.
+        GstAppSrc *appSrc = GST_APP_SRC(gst_object_ref(m_appSrc));
+        locker.unlock();
+        gst_app_src_push_buffer(appSrc, buffer);
+        gst_object_unref(appSrc);
+        return;
+    }
+    m_requested = false;
+    // Everything after refused data is out of sequence, see fetchMore().
+    if (m_overflowed)
+        return;
+    if (!m_seekable && data.size() > m_buffer.freeSpace()) {
+        // Nothing the frontend wrote after enoughData() can be asked for
+        // again, so the buffer grows rather than losing it. It shrinks back
+        // once read() has drained it, see shrinkBuffer().
+        m_buffer.setCapacity(currentBufferSize() + data.size());
+    }
+    const quint64 end = m_streamPos + currentBufferSize();
+    const int written = m_buffer.write(data.constData(), data.size());
+    if (m_seekable)
+        m_cache.write(end, data.constData(), written);
+    if (written < data.size()) {
+        // The frontend kept writing after enoughData(). For seekable streams
+        // the buffer is a hard bound, the rest is dropped and the frontend
+        // rewound to it later.
+        m_overflowed = true;
+        if (!m_enoughData) {
+            m_enoughData = true;
+            enoughData();
+        }
+    } else if (!m_enoughData && currentBufferSize() >= m_highWatermark) {
+        m_enoughData = true;
+        enoughData();
+    } else if (!m_enoughData && currentBufferSize() < m_readAhead && m_locked && !m_eos) {
+        // Sources like QIODevice only deliver one chunk per request, keep
+        // them going until the read-ahead is satisfied.
+        fetchMore();
+    }
     m_waitingForData.wakeAll();
 }
 
-GstFlowReturn StreamReader::read(quint64 pos, int length, char *buffer)
+GstFlowReturn StreamReader::read(quint64 pos, int *length, char *buffer)
 {
     QMutexLocker locker(&m_mutex);
     DEBUG_BLOCK;
@@ -100,43 +260,95 @@ GstFlowReturn StreamReader::read(quint64 pos, int length, char *buffer)
     if (!m_locked)
         return GST_FLOW_UNEXPECTED;
 
-    if (currentPos() != pos) {
-        if (!streamSeekable()) {
-            return GST_FLOW_NOT_SUPPORTED;
-        }
-        // TODO: technically an error can occur here, however the abstractstream
-        // API does not consider this, so we must assume that everything always goes
-        // alright and continue processing.
-        setCurrentPos(pos);
+    if (m_mapping) {
+        if (pos >= GST_BUFFER_SIZE(m_mapping))
+            return GST_FLOW_UNEXPECTED;
+        *length = qMin<quint64>(*length, GST_BUFFER_SIZE(m_mapping) - pos);
+        qMemCopy(buffer, GST_BUFFER_DATA(m_mapping) + pos, *length);
+        m_pos = m_streamPos = pos + *length;
+        return GST_FLOW_OK;
     }
 
-    while (currentBufferSize() < length) {
-        int oldSize = currentBufferSize();
-        needData();
-
-        m_waitingForData.wait(&m_mutex);
-
-        // Abort instantly if we got unlocked, whether we got sufficient data or not
-        // is absolutely unimportant at this point.
-        if (!m_locked)
+    // Demuxers ask for whole blocks, the last one of the stream is shorter.
+    if (m_size > 0) {
+        if (pos >= m_size)
             return GST_FLOW_UNEXPECTED;
+        *length = qMin<quint64>(*length, m_size - pos);
+    }
 
-        if (oldSize == currentBufferSize()) {
-            // We didn't get any data, check if we are at the end of stream already.
-            if (m_eos) {
-                return GST_FLOW_UNEXPECTED;
+    if (m_streamPos != pos) {
+        // Demuxers tend to jump back and forth between index and data, try
+        // to serve them from memory before going back to the frontend.
+        if (m_cache.read(pos, *length, buffer)) {
+            ++m_cacheHits;
+            m_pos = pos + *length;
+            return GST_FLOW_OK;
+        }
+        if (pos > m_streamPos && pos - m_streamPos <= (quint64) currentBufferSize()) {
+            // Short skip ahead within what we have buffered already.
+            m_buffer.skip(pos - m_streamPos);
+            m_streamPos = pos;
+        } else {
+            if (!streamSeekable()) {
+                return GST_FLOW_NOT_SUPPORTED;
             }
+            ++m_cacheMisses;
+            // TODO: technically an error can occur here, however the abstractstream
+            // API does not consider this, so we must assume that everything always goes
+            // alright and continue processing.
+            seekStreamTo(pos);
         }
     }
-    if (m_pipeline->phononState() != Phonon::BufferingState &&
-        m_pipeline->phononState() != Phonon::LoadingState) {
-        enoughData();
+
+    if (currentBufferSize() < *length) {
+        // The read-ahead did not keep up, we have to block the streaming thread.
+        QTime stall;
+        stall.start();
+        ++m_stallCount;
+
+        // A demuxer may ask for more than the buffer holds in one go (e.g. a
+        // large index), make room for this read, shrinkBuffer() undoes it.
+        if (*length > m_buffer.capacity())
+            m_buffer.setCapacity(*length);
+
+        while (currentBufferSize() < *length) {
+            int oldSize = currentBufferSize();
+            m_enoughData = false;
+            fetchMore();
+
+            m_waitingForData.wait(&m_mutex);
+
+            // Abort instantly if we got unlocked, whether we got sufficient data or not
+            // is absolutely unimportant at this point.
+            if (!m_locked)
+                break;
+
+            if (oldSize == currentBufferSize()) {
+                // We didn't get any data, check if we are at the end of stream already.
+                if (m_eos)
+                    break;
+            }
+        }
+
+        const qint64 elapsed = stall.elapsed();
+        m_stallTime += elapsed;
+        m_maxStallTime = qMax(m_maxStallTime, elapsed);
+        if (!m_locked || currentBufferSize() == 0)
+            return GST_FLOW_UNEXPECTED;
+        // Hand out the tail of the stream.
+        *length = qMin(*length, currentBufferSize());
     }
 
-    qMemCopy(buffer, m_buffer.data(), length);
-    m_pos += length;
-    //truncate the buffer
-    m_buffer = m_buffer.mid(length);
+    m_buffer.read(buffer, *length);
+    m_streamPos += *length;
+    m_pos = m_streamPos;
+    shrinkBuffer();
+
+    // Ask for more before we run dry, so that the next read does not block.
+    if (!m_requested && currentBufferSize() < m_lowWatermark && !m_eos) {
+        m_enoughData = false;
+        fetchMore();
+    }
     return GST_FLOW_OK;
 }
 
@@ -144,6 +356,8 @@ void StreamReader::endOfData()
 {
     QMutexLocker locker(&m_mutex);
     m_eos = true;
+    if (m_appSrc && m_locked)
+        gst_app_src_end_of_stream(m_appSrc);
     m_waitingForData.wakeAll();
 }
 
@@ -152,12 +366,33 @@ void StreamReader::start()
     QMutexLocker locker(&m_mutex);
     DEBUG_BLOCK;
     m_buffer.clear();
+    m_buffer.setCapacity(m_capacity);
+    m_enoughData = false;
+    m_overflowed = false;
+    m_requested = false;
     m_eos = false;
     m_locked = true;
     m_pos = 0;
+    m_streamPos = 0;
+    m_cache.clear();
+    m_cacheHits = 0;
+    m_cacheMisses = 0;
+    m_seeks = 0;
     m_seekable = false;
     m_size = 0;
+    m_stallCount = 0;
+    m_stallTime = 0;
+    m_maxStallTime = 0;
+    if (m_mapping) {
+        // Nothing to ask the frontend for, the mapping has it all.
+        m_size = GST_BUFFER_SIZE(m_mapping);
+        m_seekable = true;
+        return;
+    }
     reset();
+    // Prefetch, so that data is already flowing when the first read comes in.
+    if (!m_appSrc)
+        fetchMore();
 }
 
 void StreamReader::stop()
@@ -166,6 +401,14 @@ void StreamReader::stop()
     DEBUG_BLOCK;
     if (!m_eos)
         enoughData();
+    if (m_locked && m_stallCount > 0) {
+        debug() << "Stalled" << m_stallCount << "times for a total of" << m_stallTime
+                << "ms, longest stall" << m_maxStallTime << "ms";
+    }
+    if (m_locked && (m_cacheHits > 0 || m_seeks > 0)) {
+        debug() << "Cache hits" << m_cacheHits << "misses" << m_cacheMisses
+                << "seeks" << m_seeks;
+    }
     m_locked = false;
     m_waitingForData.wakeAll();
 }
@@ -174,6 +417,7 @@ void StreamReader::setStreamSize(qint64 newSize)
 {
     QMutexLocker locker(&m_mutex);
     m_size = newSize;
+    m_cache.setStreamSize(newSize > 0 ? newSize : 0);
 }
 
 void StreamReader::setStreamSeekable(bool seekable)
@@ -182,6 +426,133 @@ void StreamReader::setStreamSeekable(bool seekable)
     m_seekable = seekable;
 }
 
+void StreamReader::pushTo(GstAppSrc *appSrc)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_appSrc)
+        gst_object_unref(m_appSrc);
+    m_appSrc = appSrc;
+    if (!m_appSrc)
+        return;
+    gst_object_ref(m_appSrc);
+    // Pushing happens from the thread writing the data, it must never block.
+    g_object_set(m_appSrc, "block", FALSE, "max-bytes", (guint64) m_highWatermark, NULL);
+}
+
+void StreamReader::requestData()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_locked && !m_eos)
+        needData();
+}
+
+void StreamReader::pauseData()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_locked && !m_eos)
+        enoughData();
+}
+
+GstBuffer *StreamReader::mappedBuffer(int length)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_mapping || !m_locked || m_pos >= GST_BUFFER_SIZE(m_mapping))
+        return 0;
+
+    length = qMin<quint64>(length, GST_BUFFER_SIZE(m_mapping) - m_pos);
+    GstBuffer *buffer = gst_buffer_create_sub(m_mapping, m_pos, length);
+    GST_BUFFER_OFFSET(buffer) = m_pos;
+    m_pos += length;
+    m_streamPos = m_pos;
+    return buffer;
+}
+
+bool StreamReader::mapFile(const Phonon::MediaSource &source)
+{
+    // A QIODevice source is wrapped by libphonon in a stream parented to the device.
+    if (source.type() != MediaSource::Stream || !source.stream())
+        return false;
+    QFile *device = qobject_cast<QFile *>(source.stream()->parent());
+    if (!device || device->isSequential() || device->fileName().isEmpty())
+        return false;
+
+    // Map through our own handle so the position of the device stays untouched.
+    QFile *file = new QFile(device->fileName());
+    const qint64 size = file->size();
+    uchar *data = 0;
+    if (size > 0 && size <= G_MAXUINT && file->open(QIODevice::ReadOnly))
+        data = file->map(0, size);
+    if (!data) {
+        delete file;
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    madvise(data, size, MADV_SEQUENTIAL);
+#endif
+
+    m_mapping = gst_buffer_new();
+    GST_BUFFER_DATA(m_mapping) = data;
+    GST_BUFFER_SIZE(m_mapping) = size;
+    GST_BUFFER_MALLOCDATA(m_mapping) = reinterpret_cast<guint8 *>(file);
+    GST_BUFFER_FREE_FUNC(m_mapping) = cb_freeMappedFile;
+    GST_BUFFER_FLAG_SET(m_mapping, GST_BUFFER_FLAG_READONLY);
+    debug() << "Serving" << device->fileName() << "from a memory mapping";
+    return true;
+}
+
+// Expects m_mutex to be locked.
+void StreamReader::seekStreamTo(quint64 pos)
+{
+    ++m_seeks;
+    m_streamPos = pos;
+    seekStream(pos);
+    m_buffer.clear();
+    shrinkBuffer();
+    m_enoughData = false;
+    m_overflowed = false;
+    // Start refilling from the new position before the next read asks for it.
+    if (!m_appSrc && m_locked)
+        fetchMore();
+}
+
+// Expects m_mutex to be locked.
+void StreamReader::fetchMore()
+{
+    if (m_overflowed) {
+        m_overflowed = false;
+        // Resume right after the last byte we kept.
+        if (m_seekable) {
+            ++m_seeks;
+            seekStream(m_streamPos + currentBufferSize());
+        }
+    }
+    m_requested = true;
+    needData();
+}
+
+// Expects m_mutex to be locked.
+void StreamReader::shrinkBuffer()
+{
+    // Only once most of it is drained, that keeps the copy small.
+    if (m_buffer.capacity() > m_capacity && currentBufferSize() <= m_capacity / 4)
+        m_buffer.setCapacity(m_capacity);
+}
+
+void StreamReader::updateWatermarks()
+{
+    m_lowWatermark = m_capacity / 4;
+    m_highWatermark = m_capacity * 3 / 4;
+
+    // PHONON_GST_STREAM_READAHEAD (in KiB) overrides the default read-ahead,
+    // it is capped by the high watermark as nothing beyond it gets requested.
+    m_readAhead = qgetenv("PHONON_GST_STREAM_READAHEAD").toInt() * 1024;
+    if (m_readAhead <= 0)
+        m_readAhead = m_highWatermark;
+    m_readAhead = qMin(m_readAhead, m_highWatermark);
+    // Refilling starts below the low watermark, which a smaller read-ahead lowers too.
+    m_lowWatermark = qMin(m_lowWatermark, m_readAhead);
+}
+
 }
 }
 #endif //QT_NO_PHONON_ABSTRACTMEDIASTREAM
@@ -20,11 +20,14 @@
 #define PHONON_GSTREAMER_STREAMREADER_H
 
 #include <phonon/streaminterface.h>
+#include <gst/app/gstappsrc.h>
 
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 
 #include "mediaobject.h"
+#include "ringbuffer.h"
+#include "blockcache.h"
 
 #ifndef QT_NO_PHONON_ABSTRACTMEDIASTREAM
 
@@ -49,7 +52,9 @@ public:
      */
     int currentBufferSize() const;
     void writeData(const QByteArray &data);
-    GstFlowReturn read(quint64 offset, int length, char * buffer);
+    /// Reads up to *length bytes, *length is set to what was actually read,
+    /// which is less than asked for only at the end of the stream.
+    GstFlowReturn read(quint64 offset, int *length, char * buffer);
 
     bool atEnd() const;
 
@@ -66,14 +71,80 @@ public:
     void setStreamSeekable(bool seekable);
     bool streamSeekable() const;
 
+    /*
+     * Zero-copy mode: instead of being buffered and copied out by read(),
+     * the chunks handed to writeData() are wrapped as GstBuffers and pushed
+     * straight into the appsrc, which then drives needData()/enoughData().
+     */
+    bool isZeroCopy() const;
+    void pushTo(GstAppSrc *appSrc);
+    void requestData();
+    void pauseData();
+
+    // Read-ahead statistics: how often and how long read() had to block
+    // waiting for the frontend, in ms.
+    int stallCount() const;
+    qint64 stallTime() const;
+    qint64 maxStallTime() const;
+
+    // Block cache statistics: out-of-order reads served from memory, reads
+    // that had to go back to the frontend and seeks issued on the stream.
+    int cacheHits() const;
+    int cacheMisses() const;
+    int seeksIssued() const;
+
+    /*
+     * Sources backed by a seekable local file are served from a memory
+     * mapping instead of going through the frontend. mappedBuffer() returns
+     * a buffer pointing straight into the mapping, or 0 at the end.
+     */
+    bool isMapped() const;
+    GstBuffer *mappedBuffer(int length);
+
 private:
+    bool mapFile(const Phonon::MediaSource &source);
+
+    void shrinkBuffer();
+    void updateWatermarks();
+    void seekStreamTo(quint64 pos);
+    void fetchMore();
+
+    // Next offset to be read.
     quint64 m_pos;
+    // Offset of the first byte in m_buffer, i.e. where the frontend stream is at.
+    quint64 m_streamPos;
     quint64 m_size;
     bool m_eos;
     bool m_locked;
     bool m_seekable;
     Pipeline *m_pipeline;
-    QByteArray m_buffer;
+    RingBuffer m_buffer;
+    // Configured size of m_buffer, it only grows beyond that temporarily.
+    int m_capacity;
+    // read() asks the frontend for data once the fill level drops below the
+    // low watermark, writeData() tells it to pause at the high watermark.
+    int m_lowWatermark;
+    int m_highWatermark;
+    // Fill level up to which writeData() keeps requesting chunks once a
+    // refill started, at most the high watermark.
+    int m_readAhead;
+    int m_stallCount;
+    qint64 m_stallTime;
+    qint64 m_maxStallTime;
+    BlockCache m_cache;
+    int m_cacheHits;
+    int m_cacheMisses;
+    int m_seeks;
+    bool m_enoughData;
+    // The buffer refused data, the frontend has to be rewound before the
+    // next request.
+    bool m_overflowed;
+    // needData() was called and nothing has arrived since.
+    bool m_requested;
+    bool m_zeroCopy;
+    GstAppSrc *m_appSrc;
+    // Spans the whole mapping and owns it, handed out buffers are sub-buffers.
+    GstBuffer *m_mapping;
     QMutex m_mutex;
     QWaitCondition m_waitingForData;
 };
@@ -0,0 +1,104 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "check.h"
+#include "audioblockring.h"
+
+using Phonon::Gstreamer::AudioBlock;
+using Phonon::Gstreamer::AudioBlockRing;
+
+static void write(AudioBlockRing &ring, int frames)
+{
+    AudioBlock *block = ring.beginWrite();
+    CHECK(block);
+    block->reshape(1, frames, false);
+    reinterpret_cast<qint16 *>(block->plane(0))[0] = qint16(frames);
+}
+
+static void checkWrapAround()
+{
+    // Rounded up to four slots.
+    AudioBlockRing ring(3);
+    CHECK(ring.blocks() == 4);
+
+    int written = 0;
+    int read = 0;
+    // Fill the ring and drain it by varying amounts, the indices go around many times.
+    for (int round = 0; round < 25; ++round) {
+        while (written - read < ring.blocks()) {
+            write(ring, ++written);
+            CHECK(ring.endWrite() == (written - read == 1));
+        }
+        CHECK(!ring.beginWrite());
+
+        const int drain = 1 + round % ring.blocks();
+        for (int i = 0; i < drain; ++i) {
+            const AudioBlock *block = ring.beginRead();
+            CHECK(block);
+            ++read;
+            CHECK(block->frames == read);
+            CHECK(reinterpret_cast<const qint16 *>(block->plane(0))[0] == qint16(read));
+            ring.endRead();
+        }
+    }
+    CHECK(ring.underruns() == 0);
+
+    while (read < written) {
+        CHECK(ring.beginRead());
+        ring.endRead();
+        ++read;
+    }
+    CHECK(!ring.beginRead());
+    CHECK(ring.underruns() == 1);
+}
+
+static void checkStorageIsReused()
+{
+    AudioBlockRing ring(2);
+    for (int i = 0; i < ring.blocks(); ++i) {
+        write(ring, 64);
+        ring.endWrite();
+        ring.beginRead();
+        ring.endRead();
+    }
+
+    // A smaller block in a slot that held a bigger one keeps the allocation.
+    AudioBlock *block = ring.beginWrite();
+    CHECK(block);
+    const char *storage = block->data.constData();
+    block->reshape(2, 16, false);
+    CHECK(block->data.constData() == storage);
+    CHECK(block->plane(1) == block->plane(0) + 16 * sizeof(qint16));
+}
+
+static void checkOverrunCount()
+{
+    AudioBlockRing ring(1);
+    CHECK(ring.overruns() == 0);
+    write(ring, 1);
+    ring.endWrite();
+    CHECK(!ring.beginWrite());
+    ring.countOverrun();
+    CHECK(ring.overruns() == 1);
+}
+
+int main()
+{
+    checkWrapAround();
+    checkStorageIsReused();
+    checkOverrunCount();
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "check.h"
+#include "blockcache.h"
+
+#include <cstring>
+
+using Phonon::Gstreamer::BlockCache;
+
+static const int streamSize = 10;
+static const char stream[] = "0123456789";
+
+static void checkShortLastBlock()
+{
+    BlockCache cache(4, 64);
+    char out[10];
+
+    cache.setStreamSize(streamSize);
+    cache.write(0, stream, streamSize);
+
+    // Blocks [0,4) and [4,8) are full, [8,10) is the short last one.
+    CHECK(cache.read(0, 10, out));
+    CHECK(memcmp(out, stream, 10) == 0);
+    CHECK(cache.read(7, 3, out));
+    CHECK(memcmp(out, "789", 3) == 0);
+    CHECK(cache.read(9, 1, out));
+    CHECK(out[0] == '9');
+
+    // Nothing past the end is served, not even from the last block.
+    CHECK(!cache.read(9, 2, out));
+    CHECK(!cache.read(10, 1, out));
+    CHECK(!cache.read(12, 1, out));
+}
+
+static void checkUnknownSize()
+{
+    BlockCache cache(4, 64);
+    char out[10];
+
+    // Without a stream size the trailing partial block is never complete.
+    cache.write(0, stream, streamSize);
+    CHECK(cache.read(0, 8, out));
+    CHECK(!cache.read(8, 2, out));
+}
+
+static void checkStreamSizeChange()
+{
+    BlockCache cache(4, 64);
+    char out[10];
+
+    cache.setStreamSize(6);
+    cache.write(0, stream, 6);
+    CHECK(cache.read(4, 2, out));
+
+    // The stream grew, the short block cached for the old end is stale.
+    cache.setStreamSize(streamSize);
+    CHECK(!cache.read(4, 2, out));
+    CHECK(cache.read(0, 4, out));
+
+    cache.write(4, stream + 4, 6);
+    CHECK(cache.read(4, 6, out));
+    CHECK(memcmp(out, "456789", 6) == 0);
+}
+
+int main()
+{
+    checkShortLastBlock();
+    checkUnknownSize();
+    checkStreamSizeChange();
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Throughput of deinterleave() next to the loop AudioDataOutput used before,
+ * which appended every sample to its channel's QVector, and a plain indexed
+ * loop. Prints Msamples/s, for int16 and float32 output, per channel layout.
+ */
+
+#include "deinterleave.h"
+
+#include <QtCore/QTime>
+#include <QtCore/QVector>
+
+#include <cstdio>
+
+using Phonon::Gstreamer::deinterleave;
+
+static const int frames = 4096;
+static const int minTime = 200;
+
+template <typename T>
+static void appendLoop(const T *in, QVector<QVector<T> > &out, int channels)
+{
+    for (int c = 0; c < channels; ++c)
+        out[c].clear();
+    for (int i = 0; i < frames; ++i) {
+        for (int c = 0; c < channels; ++c)
+            out[c].append(in[i * channels + c]);
+    }
+}
+
+template <typename T>
+static void indexedLoop(const T *in, T *const *out, int channels)
+{
+    for (int i = 0; i < frames; ++i) {
+        for (int c = 0; c < channels; ++c)
+            out[c][i] = in[i * channels + c];
+    }
+}
+
+// Runs the kernel for at least minTime ms, returns Msamples/s.
+template <typename Kernel>
+static double measure(Kernel kernel, int channels)
+{
+    QTime time;
+    time.start();
+    int runs = 0;
+    int elapsed;
+    do {
+        for (int i = 0; i < 64; ++i)
+            kernel();
+        runs += 64;
+        elapsed = time.elapsed();
+    } while (elapsed < minTime);
+    return double(runs) * frames * channels / elapsed / 1000.0;
+}
+
+template <typename T>
+struct Append
+{
+    const T *in; QVector<QVector<T> > *out; int channels;
+    void operator()() { appendLoop(in, *out, channels); }
+};
+
+template <typename T>
+struct Indexed
+{
+    const T *in; T *const *out; int channels;
+    void operator()() { indexedLoop(in, out, channels); }
+};
+
+template <typename T>
+struct Bulk
+{
+    const T *in; T *const *out; int channels;
+    void operator()() { deinterleave(in, out, channels, frames); }
+};
+
+template <typename T>
+static void run(const char *type, int channels)
+{
+    QVector<T> in(frames * channels);
+    for (int i = 0; i < in.size(); ++i)
+        in[i] = T(i % 1000);
+    QVector<QVector<T> > vectors(channels);
+    QVector<QVector<T> > planes(channels, QVector<T>(frames));
+    QVector<T *> out(channels);
+    for (int c = 0; c < channels; ++c)
+        out[c] = planes[c].data();
+
+    Append<T> append = { in.constData(), &vectors, channels };
+    Indexed<T> indexed = { in.constData(), out.constData(), channels };
+    Bulk<T> bulk = { in.constData(), out.constData(), channels };
+    printf("%-6s %d ch  append %8.1f  indexed %8.1f  deinterleave %8.1f\n", type, channels,
+           measure(append, channels), measure(indexed, channels), measure(bulk, channels));
+}
+
+int main()
+{
+    const int layouts[] = { 1, 2, 6, 8 };
+    printf("Msamples/s, %d frames per buffer\n", frames);
+    for (unsigned i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i)
+        run<qint16>("int16", layouts[i]);
+    for (unsigned i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i)
+        run<float>("float", layouts[i]);
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "check.h"
+#include "deinterleave.h"
+
+#include <vector>
+
+using Phonon::Gstreamer::deinterleave;
+
+static const int maxChannels = 8;
+// Around the 8 frame SIMD blocks, so that both the kernels and the tail run.
+static const int frameCounts[] = { 1, 7, 8, 9, 15, 16, 17, 63, 64, 1031 };
+static const int frameCountCount = sizeof(frameCounts) / sizeof(frameCounts[0]);
+
+// Compares against the plain loop, with a guard sample behind every plane.
+template <typename T>
+static void checkAgainstScalar(int channels, int frames, T base)
+{
+    std::vector<T> in(channels * frames);
+    for (int i = 0; i < channels * frames; ++i)
+        in[i] = base + T((i * 7919) % 65521 - 32760);
+
+    const T guard = T(12345);
+    std::vector<std::vector<T> > planes(maxChannels, std::vector<T>(frames + 1, guard));
+    T *out[maxChannels];
+    for (int c = 0; c < maxChannels; ++c)
+        out[c] = &planes[c][0];
+
+    deinterleave(&in[0], out, channels, frames);
+
+    for (int c = 0; c < channels; ++c) {
+        for (int i = 0; i < frames; ++i)
+            CHECK(out[c][i] == in[i * channels + c]);
+        CHECK(out[c][frames] == guard);
+    }
+}
+
+int main()
+{
+    const int shortLayouts[] = { 1, 2, 3, 6, 8 };
+    for (unsigned l = 0; l < sizeof(shortLayouts) / sizeof(shortLayouts[0]); ++l) {
+        for (int f = 0; f < frameCountCount; ++f)
+            checkAgainstScalar<qint16>(shortLayouts[l], frameCounts[f], 0);
+    }
+
+    const int floatLayouts[] = { 1, 2, 6 };
+    for (unsigned l = 0; l < sizeof(floatLayouts) / sizeof(floatLayouts[0]); ++l) {
+        for (int f = 0; f < frameCountCount; ++f)
+            checkAgainstScalar<float>(floatLayouts[l], frameCounts[f], 0.25f);
+    }
+    return 0;
+}
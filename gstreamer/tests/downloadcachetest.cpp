@@ -0,0 +1,131 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "check.h"
+#include "downloadcache.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+#include <unistd.h>
+#include <utime.h>
+
+using Phonon::Gstreamer::DownloadCache;
+
+static QDir s_work;
+
+// A finished download of size KiB, as playbin2 leaves it in the temp dir.
+static QString download(const char *name, int size)
+{
+    const QString file = s_work.filePath(QLatin1String(name));
+    QFile out(file);
+    CHECK(out.open(QIODevice::WriteOnly));
+    CHECK(out.write(QByteArray(size * 1024, name[0])) == size * 1024);
+    return file;
+}
+
+static void setAge(const QString &file, int seconds)
+{
+    const time_t then = QDateTime::currentDateTime().toTime_t() - seconds;
+    struct utimbuf times = { then, then };
+    CHECK(utime(QFile::encodeName(file).constData(), &times) == 0);
+}
+
+static bool sameContents(const QString &a, const QString &b)
+{
+    QFile fa(a);
+    QFile fb(b);
+    return fa.open(QIODevice::ReadOnly) && fb.open(QIODevice::ReadOnly) && fa.readAll() == fb.readAll();
+}
+
+static void checkDisabled()
+{
+    qputenv("PHONON_GST_DOWNLOAD_CACHE_SIZE", "0");
+    DownloadCache cache;
+    CHECK(!cache.isEnabled());
+    CHECK(!cache.store(QUrl(QLatin1String("http://localhost/off")), download("off", 1)));
+    CHECK(cache.lookup(QUrl(QLatin1String("http://localhost/off"))).isEmpty());
+}
+
+static void checkStoreLookupEvict()
+{
+    // Room for 1 MiB.
+    qputenv("PHONON_GST_DOWNLOAD_CACHE_SIZE", "1");
+    DownloadCache cache;
+    CHECK(cache.isEnabled());
+
+    const QUrl a(QLatin1String("http://localhost/a.ogg"));
+    const QUrl b(QLatin1String("http://localhost/b.ogg"));
+    const QUrl c(QLatin1String("http://localhost/c.ogg"));
+
+    CHECK(cache.lookup(a).isEmpty());
+    const QString fileA = download("a", 600);
+    CHECK(cache.store(a, fileA));
+    // The temporary file may go away, the entry stays.
+    const QString cachedA = cache.lookup(a);
+    CHECK(!cachedA.isEmpty());
+    CHECK(sameContents(cachedA, fileA));
+    QFile::remove(fileA);
+    CHECK(QFile::exists(cachedA));
+
+    CHECK(cache.store(b, download("b", 300)));
+    CHECK(!cache.lookup(b).isEmpty());
+    CHECK(cache.lookup(a) != cache.lookup(b));
+
+    // Playing a again makes b the least recently used entry.
+    setAge(cachedA, 100);
+    setAge(cache.lookup(b), 50);
+    CHECK(cache.lookup(a) == cachedA);
+
+    // Over the bound, b goes.
+    CHECK(cache.store(c, download("c", 300)));
+    CHECK(cache.lookup(b).isEmpty());
+    CHECK(!cache.lookup(a).isEmpty());
+    CHECK(!cache.lookup(c).isEmpty());
+
+    // Nothing larger than the whole cache is taken.
+    CHECK(!cache.store(QUrl(QLatin1String("http://localhost/big.ogg")), download("big", 2048)));
+}
+
+static void removeAll(const QDir &dir)
+{
+    foreach (const QString &entry, dir.entryList(QDir::Files))
+        QFile::remove(dir.filePath(entry));
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    // Downloads are hard linked into the cache, so both live in one directory.
+    const QString name = QString::fromLatin1("phonon-gstreamer-downloadcachetest-%1").arg(getpid());
+    CHECK(QDir::temp().mkpath(name));
+    s_work = QDir(QDir::temp().filePath(name));
+    CHECK(s_work.mkpath(QLatin1String("cache")));
+    qputenv("PHONON_GST_DOWNLOAD_CACHE_DIR", QFile::encodeName(s_work.filePath(QLatin1String("cache"))));
+
+    checkDisabled();
+    checkStoreLookupEvict();
+
+    removeAll(QDir(s_work.filePath(QLatin1String("cache"))));
+    s_work.rmdir(QLatin1String("cache"));
+    removeAll(s_work);
+    QDir::temp().rmdir(name);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "check.h"
+#include "fft.h"
+
+#include <cmath>
+#include <vector>
+
+using Phonon::Gstreamer::FFT;
+
+static const int size = 1024;
+
+static bool isNear(float value, float expected, float tolerance)
+{
+    return std::fabs(value - expected) <= tolerance;
+}
+
+// Whole numbers of periods land exactly on a bin, the Hann window spreads
+// them over that bin and half as much on each neighbour.
+static void checkSines()
+{
+    FFT fft(size);
+    CHECK(fft.size() == size);
+
+    const double pi = 3.14159265358979323846;
+    std::vector<float> in(size);
+    for (int i = 0; i < size; ++i)
+        in[i] = float(std::sin(2 * pi * 100 * i / size) + 0.5 * std::cos(2 * pi * 300 * i / size));
+
+    std::vector<float> magnitudes(size / 2);
+    fft.transform(&in[0], &magnitudes[0]);
+
+    CHECK(isNear(magnitudes[100], 1.0f, 1e-3f));
+    CHECK(isNear(magnitudes[99], 0.5f, 1e-3f));
+    CHECK(isNear(magnitudes[101], 0.5f, 1e-3f));
+    CHECK(isNear(magnitudes[300], 0.5f, 1e-3f));
+    CHECK(isNear(magnitudes[299], 0.25f, 1e-3f));
+    CHECK(isNear(magnitudes[301], 0.25f, 1e-3f));
+
+    for (int bin = 0; bin < size / 2; ++bin) {
+        if (std::abs(bin - 100) > 1 && std::abs(bin - 300) > 1)
+            CHECK(magnitudes[bin] < 1e-3f);
+    }
+
+    // transform() leaves no state behind.
+    std::vector<float> again(size / 2);
+    fft.transform(&in[0], &again[0]);
+    for (int bin = 0; bin < size / 2; ++bin)
+        CHECK(again[bin] == magnitudes[bin]);
+}
+
+static void checkSilence()
+{
+    FFT fft(size);
+    std::vector<float> in(size, 0.0f);
+    std::vector<float> magnitudes(size / 2, 1.0f);
+    fft.transform(&in[0], &magnitudes[0]);
+    for (int bin = 0; bin < size / 2; ++bin)
+        CHECK(magnitudes[bin] == 0.0f);
+}
+
+int main()
+{
+    checkSines();
+    checkSilence();
+    return 0;
+}
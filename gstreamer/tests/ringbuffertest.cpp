@@ -0,0 +1,81 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "check.h"
+#include "ringbuffer.h"
+
+#include <cstring>
+
+using Phonon::Gstreamer::RingBuffer;
+
+static void checkWrapAround()
+{
+    RingBuffer ring(8);
+    char out[8];
+
+    CHECK(ring.write("abcde", 5) == 5);
+    CHECK(ring.read(out, 3) == 3);
+    CHECK(memcmp(out, "abc", 3) == 0);
+
+    // Starts at offset 5 and wraps after three bytes.
+    CHECK(ring.write("fghijk", 6) == 6);
+    CHECK(ring.size() == 8);
+    CHECK(ring.freeSpace() == 0);
+
+    CHECK(ring.peek(out, 4, 2) == 4);
+    CHECK(memcmp(out, "fghi", 4) == 0);
+
+    CHECK(ring.read(out, 8) == 8);
+    CHECK(memcmp(out, "defghijk", 8) == 0);
+    CHECK(ring.isEmpty());
+}
+
+static void checkCapacityIsABound()
+{
+    RingBuffer ring(4);
+    char out[4];
+
+    CHECK(ring.write("abcdef", 6) == 4);
+    CHECK(ring.capacity() == 4);
+    CHECK(ring.write("g", 1) == 0);
+
+    CHECK(ring.skip(3) == 3);
+    CHECK(ring.write("xyz", 3) == 3);
+    CHECK(ring.read(out, 4) == 4);
+    CHECK(memcmp(out, "dxyz", 4) == 0);
+}
+
+static void checkSetCapacityKeepsData()
+{
+    RingBuffer ring(4);
+    char out[6];
+
+    ring.write("abcd", 4);
+    ring.skip(2);
+    ring.write("ef", 2);
+    ring.setCapacity(6);
+    CHECK(ring.capacity() == 6);
+    CHECK(ring.write("gh", 2) == 2);
+    CHECK(ring.read(out, 6) == 6);
+    CHECK(memcmp(out, "cdefgh", 6) == 0);
+}
+
+int main()
+{
+    checkWrapAround();
+    checkCapacityIsABound();
+    checkSetCapacityKeepsData();
+    return 0;
+}
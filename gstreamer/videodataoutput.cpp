@@ -21,11 +21,13 @@
 */
 
 #include "videodataoutput.h"
+#include "debug.h"
 #include <phonon/experimental/videoframe2.h>
 
 #include <gst/gstbin.h>
 #include <gst/gstghostpad.h>
 #include <gst/gstutils.h>
+#include <gst/video/video.h>
 
 namespace Phonon
 {
@@ -35,8 +37,15 @@ namespace Gstreamer
 VideoDataOutput::VideoDataOutput(Backend *backend, QObject *parent)
     : QObject(parent),
       MediaNode(backend, VideoSink),
-      m_frontend(0)
+      m_frontend(0),
+      m_deliveryMode(DirectDelivery),
+      m_delivered(0),
+      m_dropped(0)
 {
+    qRegisterMetaType<VideoFrameBuffer>("Phonon::Gstreamer::VideoFrameBuffer");
+
+    m_formats << Experimental::VideoFrame2::Format_RGB888;
+
     static int count = 0;
     m_name = "VideoDataOutput" + QString::number(count++);
 
@@ -47,22 +56,14 @@ VideoDataOutput::VideoDataOutput(Backend *backend, QObject *parent)
     GstElement* sink = gst_element_factory_make("fakesink", NULL);
     GstElement* queue = gst_element_factory_make("queue", NULL);
     GstElement* convert = gst_element_factory_make("ffmpegcolorspace", NULL);
+    m_capsFilter = gst_element_factory_make("capsfilter", NULL);
 
     g_signal_connect(sink, "handoff", G_CALLBACK(processBuffer), this);
     g_object_set(G_OBJECT(sink), "signal-handoffs", true, NULL);
 
-        // Save ourselves a metric crapton of work by simply requesting
-        // a format native to Qt.
-    GstCaps *caps = gst_caps_new_simple("video/x-raw-rgb",
-                                        "bpp", G_TYPE_INT, 24,
-                                        "depth", G_TYPE_INT, 24,
-                                        "endianess", G_TYPE_INT, G_BYTE_ORDER,
-                                        NULL);
-
-    gst_bin_add_many(GST_BIN(m_queue), sink, convert, queue, NULL);
-    gst_element_link(queue, convert);
-    gst_element_link_filtered(convert, sink, caps);
-    gst_caps_unref(caps);
+    gst_bin_add_many(GST_BIN(m_queue), sink, convert, m_capsFilter, queue, NULL);
+    gst_element_link_many(queue, convert, m_capsFilter, sink, NULL);
+    updateCaps();
 
     GstPad *inputpad = gst_element_get_static_pad(queue, "sink");
     gst_element_add_pad(m_queue, gst_ghost_pad_new("sink", inputpad));
@@ -79,30 +80,157 @@ VideoDataOutput::~VideoDataOutput()
     gst_object_unref(m_queue);
 }
 
+QList<int> VideoDataOutput::allowedFormats() const
+{
+    return m_formats;
+}
+
+void VideoDataOutput::setAllowedFormats(const QList<int> &formats)
+{
+    m_formats = formats;
+    updateCaps();
+}
+
+/*
+ * The order of the caps is our order of preference. ffmpegcolorspace passes
+ * buffers through untouched when the decoder's format is among them, the
+ * conversion only happens when nothing matches.
+ */
+void VideoDataOutput::updateCaps()
+{
+    GstCaps *caps = gst_caps_new_empty();
+    foreach (int format, m_formats) {
+        switch (format) {
+        case Experimental::VideoFrame2::Format_RGB888:
+            gst_caps_append(caps, gst_video_format_new_template_caps(GST_VIDEO_FORMAT_RGB));
+            break;
+        case Experimental::VideoFrame2::Format_RGB32:
+            // QImage::Format_RGB32 is 0xffRRGGBB in host order.
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+            gst_caps_append(caps, gst_video_format_new_template_caps(GST_VIDEO_FORMAT_BGRx));
+#else
+            gst_caps_append(caps, gst_video_format_new_template_caps(GST_VIDEO_FORMAT_xRGB));
+#endif
+            break;
+        case Experimental::VideoFrame2::Format_YV12:
+            // Same planes in a different order, see processBuffer().
+            gst_caps_append(caps, gst_video_format_new_template_caps(GST_VIDEO_FORMAT_YV12));
+            gst_caps_append(caps, gst_video_format_new_template_caps(GST_VIDEO_FORMAT_I420));
+            break;
+        case Experimental::VideoFrame2::Format_YUY2:
+            gst_caps_append(caps, gst_video_format_new_template_caps(GST_VIDEO_FORMAT_YUY2));
+            break;
+        default:
+            warning() << "Unsupported video frame format" << format;
+            break;
+        }
+    }
+    if (gst_caps_is_empty(caps)) {
+        gst_caps_unref(caps);
+        caps = gst_video_format_new_template_caps(GST_VIDEO_FORMAT_RGB);
+    }
+    g_object_set(G_OBJECT(m_capsFilter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+}
+
+void VideoDataOutput::setFrontendObject(Phonon::Experimental::AbstractVideoDataOutput *object)
+{
+    QMutexLocker lock(&m_mailboxLock);
+    m_frontend = object;
+}
+
+int VideoDataOutput::deliveryMode() const
+{
+    return m_deliveryMode;
+}
+
+void VideoDataOutput::setDeliveryMode(int mode)
+{
+    if (mode != DirectDelivery && mode != MailboxDelivery) {
+        warning() << "Invalid delivery mode" << mode;
+        return;
+    }
+    QMutexLocker lock(&m_mailboxLock);
+    m_deliveryMode = static_cast<DeliveryMode>(mode);
+    if (m_deliveryMode == DirectDelivery)
+        m_mailbox = VideoFrameBuffer();
+}
+
+/*
+ * Never blocks the streaming thread on the consumer. Only the transition
+ * from empty to full wakes the consumer up, a consumer that lags behind
+ * just finds the newest frame once it gets to it.
+ */
+void VideoDataOutput::post(const VideoFrameBuffer &frame)
+{
+    bool wasEmpty;
+    {
+        QMutexLocker lock(&m_mailboxLock);
+        wasEmpty = m_mailbox.isNull();
+        m_mailbox = frame;
+    }
+    if (!wasEmpty)
+        m_dropped.ref();
+    else
+        QMetaObject::invokeMethod(this, "deliverPending", Qt::QueuedConnection);
+}
+
+VideoFrameBuffer VideoDataOutput::takeFrame()
+{
+    VideoFrameBuffer frame;
+    {
+        QMutexLocker lock(&m_mailboxLock);
+        qSwap(frame, m_mailbox);
+    }
+    if (!frame.isNull())
+        m_delivered.ref();
+    return frame;
+}
+
+void VideoDataOutput::deliverPending()
+{
+    if (!m_frontend) {
+        emit frameAvailable();
+        return;
+    }
+    const VideoFrameBuffer frame = takeFrame();
+    if (!frame.isNull())
+        m_frontend->frameReady(frame.frame());
+}
+
+int VideoDataOutput::deliveredFrames() const
+{
+    return m_delivered;
+}
+
+int VideoDataOutput::droppedFrames() const
+{
+    return m_dropped;
+}
+
 void VideoDataOutput::processBuffer(GstElement*, GstBuffer* buffer, GstPad*, gpointer gThat)
 {
     VideoDataOutput *that = reinterpret_cast<VideoDataOutput*>(gThat);
 
-    GstStructure* structure = gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0);
-    int width;
-    int height;
-    double aspect;
-
-    gst_structure_get_int(structure, "width", &width);
-    gst_structure_get_int(structure, "height", &height);
-    aspect = (double)width/height;
-    const Experimental::VideoFrame2 f = {
-        width,
-        height,
-        aspect,
-        Experimental::VideoFrame2::Format_RGB888,
-                // RGB888 Means the data is 8 bits o' red, 8 bits o' green, and 8 bits o' blue per pixel.
-        QByteArray::fromRawData(reinterpret_cast<const char*>(GST_BUFFER_DATA(buffer)), 3*width*height),
-        0,
-        0
-    };
-    if (that->m_frontend)
-        that->m_frontend->frameReady(f);
+    // Holds a reference on the buffer, whoever keeps a copy of the handle
+    // keeps the frame alive without copying it.
+    const VideoFrameBuffer frame(buffer);
+    if (frame.isNull())
+        return;
+
+    DeliveryMode mode;
+    Phonon::Experimental::AbstractVideoDataOutput *frontend;
+    {
+        QMutexLocker lock(&that->m_mailboxLock);
+        mode = that->m_deliveryMode;
+        frontend = that->m_frontend;
+    }
+    if (mode == MailboxDelivery)
+        that->post(frame);
+    else if (frontend)
+        frontend->frameReady(frame.frame());
+    if (that->receivers(SIGNAL(frameBufferReady(Phonon::Gstreamer::VideoFrameBuffer))) > 0)
+        emit that->frameBufferReady(frame);
 }
 
 }} // namespace Phonon::Gstreamer
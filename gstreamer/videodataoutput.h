@@ -24,6 +24,9 @@
 #define Phonon_GSTREAMER_VIDEODATAOUTPUT_H
 
 #include "medianode.h"
+#include "videoframebuffer.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
 #include <phonon/experimental/abstractvideodataoutput.h>
 #include <phonon/experimental/videodataoutputinterface.h>
 
@@ -45,19 +48,65 @@ class Backend;
         Q_INTERFACES(Phonon::Experimental::VideoDataOutputInterface Phonon::Gstreamer::MediaNode)
 
     public:
+        enum DeliveryMode {
+            // The frontend is called from the streaming thread, a slow
+            // consumer holds back the whole pipeline.
+            DirectDelivery,
+            // Frames go into a single slot mailbox, the newest one replaces
+            // a pending one. The frontend is called from the event loop.
+            MailboxDelivery
+        };
+
         VideoDataOutput(Backend *, QObject *);
         ~VideoDataOutput();
 
         static void processBuffer(GstElement*, GstBuffer*, GstPad*, gpointer);
 
         Phonon::Experimental::AbstractVideoDataOutput *frontendObject() const { return m_frontend; }
-        void setFrontendObject(Phonon::Experimental::AbstractVideoDataOutput *object) { m_frontend = object; }
+        void setFrontendObject(Phonon::Experimental::AbstractVideoDataOutput *object);
 
         GstElement *videoElement() { return m_queue; }
 
+    public Q_SLOTS:
+        // Experimental::VideoFrame2::Format values the consumer accepts, most
+        // wanted first. RGB888 only by default.
+        QList<int> allowedFormats() const;
+        void setAllowedFormats(const QList<int> &formats);
+
+        int deliveryMode() const;
+        void setDeliveryMode(int mode);
+        // Pull side of MailboxDelivery, a null frame if nothing is pending.
+        Phonon::Gstreamer::VideoFrameBuffer takeFrame();
+        // Frames taken from the mailbox, and frames replaced in it unseen.
+        int deliveredFrames() const;
+        int droppedFrames() const;
+
+    signals:
+        // Same frame as given to the frontend, but safe to keep and to pass
+        // to other threads. Only built while something is connected.
+        void frameBufferReady(const Phonon::Gstreamer::VideoFrameBuffer &frame);
+        // The mailbox got a frame while it was empty and there is no
+        // frontend to take it, see takeFrame().
+        void frameAvailable();
+
+    private Q_SLOTS:
+        void deliverPending();
+
     private:
+        void updateCaps();
+        void post(const VideoFrameBuffer &frame);
+
         GstElement *m_queue;
+        GstElement *m_capsFilter;
+        QList<int> m_formats;
+        // Written from the main thread under m_mailboxLock, which the
+        // streaming thread holds to read them.
         Phonon::Experimental::AbstractVideoDataOutput *m_frontend;
+        DeliveryMode m_deliveryMode;
+        QMutex m_mailboxLock;
+        VideoFrameBuffer m_mailbox;
+        QAtomicInt m_delivered;
+        QAtomicInt m_dropped;
     };
 
 }} //namespace Phonon::Gstreamer
@@ -0,0 +1,145 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "videoframebuffer.h"
+
+#include <gst/video/video.h>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+VideoFrameBuffer::Data::~Data()
+{
+    gst_buffer_unref(buffer);
+}
+
+VideoFrameBuffer::VideoFrameBuffer()
+{
+}
+
+VideoFrameBuffer::VideoFrameBuffer(GstBuffer *buffer)
+{
+    Experimental::VideoFrame2 frame;
+    if (!describe(buffer, &frame))
+        return;
+    d = new Data;
+    d->buffer = gst_buffer_ref(buffer);
+    d->frame = frame;
+}
+
+const Experimental::VideoFrame2 &VideoFrameBuffer::frame() const
+{
+    static const Experimental::VideoFrame2 invalid = {
+        0, 0, 0, Experimental::VideoFrame2::Format_Invalid, QByteArray(), QByteArray(), QByteArray()
+    };
+    return d ? d->frame : invalid;
+}
+
+GstBuffer *VideoFrameBuffer::buffer() const
+{
+    return d ? d->buffer : 0;
+}
+
+GstClockTime VideoFrameBuffer::timestamp() const
+{
+    return d ? GST_BUFFER_TIMESTAMP(d->buffer) : GST_CLOCK_TIME_NONE;
+}
+
+/*
+ * VideoFrame2 has no stride, its rows are expected back to back. GStreamer
+ * pads rows to 4 bytes (8 for I420/YV12 chroma), such planes are packed into
+ * a copy. All others point straight into the buffer.
+ */
+static QByteArray plane(GstBuffer *buffer, int offset, int stride, int rowSize, int rows)
+{
+    const char *data = reinterpret_cast<const char*>(GST_BUFFER_DATA(buffer)) + offset;
+    if (stride == rowSize)
+        return QByteArray::fromRawData(data, rowSize * rows);
+
+    QByteArray packed;
+    packed.resize(rowSize * rows);
+    char *out = packed.data();
+    for (int row = 0; row < rows; ++row) {
+        qMemCopy(out, data, rowSize);
+        out += rowSize;
+        data += stride;
+    }
+    return packed;
+}
+
+bool VideoFrameBuffer::describe(GstBuffer *buffer, Experimental::VideoFrame2 *frame)
+{
+    GstVideoFormat format;
+    int width;
+    int height;
+    if (!gst_video_format_parse_caps(GST_BUFFER_CAPS(buffer), &format, &width, &height))
+        return false;
+
+    int parN = 1;
+    int parD = 1;
+    gst_video_parse_caps_pixel_aspect_ratio(GST_BUFFER_CAPS(buffer), &parN, &parD);
+
+    Experimental::VideoFrame2 &f = *frame;
+    f.width = width;
+    f.height = height;
+    f.aspectRatio = (double)width * parN / (height * parD);
+
+    int rowSize = 0;
+    switch (format) {
+    case GST_VIDEO_FORMAT_RGB:
+        // RGB888 Means the data is 8 bits o' red, 8 bits o' green, and 8 bits o' blue per pixel.
+        f.format = Experimental::VideoFrame2::Format_RGB888;
+        rowSize = width * 3;
+        break;
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_xRGB:
+        f.format = Experimental::VideoFrame2::Format_RGB32;
+        rowSize = width * 4;
+        break;
+    case GST_VIDEO_FORMAT_YUY2:
+        f.format = Experimental::VideoFrame2::Format_YUY2;
+        rowSize = GST_ROUND_UP_2(width) * 2;
+        break;
+    case GST_VIDEO_FORMAT_YV12:
+    case GST_VIDEO_FORMAT_I420:
+        f.format = Experimental::VideoFrame2::Format_YV12;
+        break;
+    default:
+        return false;
+    }
+
+    if (f.format == Experimental::VideoFrame2::Format_YV12) {
+        // data0 is Y, data1 and data2 are V and U, in the order of YV12.
+        // I420 only stores U first, handing out the planes swapped is enough.
+        const int chromaWidth = GST_ROUND_UP_2(width) / 2;
+        const int chromaHeight = GST_ROUND_UP_2(height) / 2;
+        f.data0 = plane(buffer, gst_video_format_get_component_offset(format, 0, width, height),
+                        gst_video_format_get_row_stride(format, 0, width), width, height);
+        f.data1 = plane(buffer, gst_video_format_get_component_offset(format, 2, width, height),
+                        gst_video_format_get_row_stride(format, 2, width), chromaWidth, chromaHeight);
+        f.data2 = plane(buffer, gst_video_format_get_component_offset(format, 1, width, height),
+                        gst_video_format_get_row_stride(format, 1, width), chromaWidth, chromaHeight);
+    } else {
+        f.data0 = plane(buffer, 0, gst_video_format_get_row_stride(format, 0, width), rowSize, height);
+        f.data1 = QByteArray();
+        f.data2 = QByteArray();
+    }
+    return true;
+}
+
+}
+}
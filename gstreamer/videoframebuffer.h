@@ -0,0 +1,68 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_GSTREAMER_VIDEOFRAMEBUFFER_H
+#define PHONON_GSTREAMER_VIDEOFRAMEBUFFER_H
+
+#include <gst/gst.h>
+#include <phonon/experimental/videoframe2.h>
+#include <QtCore/QMetaType>
+#include <QtCore/QSharedData>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Implicitly shared handle of a decoded video frame.
+ *
+ * The handle keeps a reference on the GstBuffer the frame lives in, so it
+ * can be kept or passed to other threads without copying the pixels. The
+ * buffer goes back to its owner once the last handle is gone. The planes of
+ * frame() point into the buffer and are only valid as long as a handle is.
+ */
+class VideoFrameBuffer
+{
+public:
+    VideoFrameBuffer();
+    /// Takes a reference on buffer, null if its format is not supported.
+    explicit VideoFrameBuffer(GstBuffer *buffer);
+
+    bool isNull() const { return !d; }
+    const Experimental::VideoFrame2 &frame() const;
+    GstBuffer *buffer() const;
+    GstClockTime timestamp() const;
+
+    /// Describes buffer in frame, with planes pointing into its data. Planes
+    /// with padded rows are packed into copies.
+    static bool describe(GstBuffer *buffer, Experimental::VideoFrame2 *frame);
+
+private:
+    struct Data : public QSharedData
+    {
+        ~Data();
+        GstBuffer *buffer;
+        Experimental::VideoFrame2 frame;
+    };
+    QExplicitlySharedDataPointer<Data> d;
+};
+
+}
+}
+
+Q_DECLARE_METATYPE(Phonon::Gstreamer::VideoFrameBuffer)
+
+#endif // PHONON_GSTREAMER_VIDEOFRAMEBUFFER_H
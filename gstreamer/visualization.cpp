@@ -0,0 +1,220 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "visualization.h"
+
+#include <gst/gst.h>
+#include <math.h>
+
+// Samples per transform, about 43 msec at 48 kHz
+#define FFT_SIZE 2048
+#define LOWEST_BAND_HZ 20.0
+// Lowest rate setBandCount() plans for, see maxBands()
+#define MIN_SAMPLE_RATE 8000
+// Floor for the dB values of silence
+#define MIN_LEVEL 1e-6f
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+Visualization::Visualization(Backend *backend, QObject *parent)
+    : QObject(parent)
+    , MediaNode(backend, AudioSink)
+    , m_bandCount(32)
+    , m_frameRate(30)
+    , m_fft(FFT_SIZE)
+    , m_history(FFT_SIZE)
+    , m_historyPos(0)
+    , m_samples(FFT_SIZE)
+    , m_magnitudes(FFT_SIZE / 2)
+    , m_levelFrames(0)
+    , m_edgesRate(0)
+{
+    qRegisterMetaType<QVector<float> >("QVector<float>");
+
+    static int count = 0;
+    m_name = "Visualization" + QString::number(count++);
+
+    m_bin = gst_bin_new(NULL);
+    gst_object_ref(GST_OBJECT(m_bin));
+    gst_object_sink(GST_OBJECT(m_bin));
+    GstElement *queue = gst_element_factory_make("queue", NULL);
+    GstElement *convert = gst_element_factory_make("audioconvert", NULL);
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+
+    g_signal_connect(sink, "handoff", G_CALLBACK(processBuffer), this);
+    g_object_set(G_OBJECT(sink), "signal-handoffs", true, "sync", true, NULL);
+
+    GstCaps *caps = gst_caps_new_simple("audio/x-raw-float",
+                                        "endianness", G_TYPE_INT, G_BYTE_ORDER,
+                                        "width", G_TYPE_INT, 32,
+                                        NULL);
+    gst_bin_add_many(GST_BIN(m_bin), queue, convert, sink, NULL);
+    gst_element_link(queue, convert);
+    gst_element_link_filtered(convert, sink, caps);
+    gst_caps_unref(caps);
+
+    GstPad *inputpad = gst_element_get_static_pad(queue, "sink");
+    gst_element_add_pad(m_bin, gst_ghost_pad_new("sink", inputpad));
+    gst_object_unref(inputpad);
+
+    m_isValid = true;
+}
+
+Visualization::~Visualization()
+{
+    gst_element_set_state(m_bin, GST_STATE_NULL);
+    gst_object_unref(m_bin);
+}
+
+// Every band needs a bin of its own, and only bins above LOWEST_BAND_HZ count.
+static int maxBands(int sampleRate)
+{
+    return FFT_SIZE / 2 - int(LOWEST_BAND_HZ * FFT_SIZE / sampleRate);
+}
+
+int Visualization::bandCount() const
+{
+    return m_bandCount;
+}
+
+void Visualization::setBandCount(int count)
+{
+    // The rate is not known yet, the lowest one leaves the fewest bins.
+    m_bandCount.fetchAndStoreOrdered(qBound(1, count, maxBands(MIN_SAMPLE_RATE)));
+}
+
+int Visualization::frameRate() const
+{
+    return m_frameRate;
+}
+
+void Visualization::setFrameRate(int fps)
+{
+    m_frameRate.fetchAndStoreOrdered(qMax(1, fps));
+}
+
+void Visualization::processBuffer(GstElement*, GstBuffer *buffer, GstPad*, gpointer data)
+{
+    Visualization *that = static_cast<Visualization *>(data);
+
+    GstStructure *structure = gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0);
+    int channels = 0;
+    int rate = 0;
+    gst_structure_get_int(structure, "channels", &channels);
+    gst_structure_get_int(structure, "rate", &rate);
+    if (channels <= 0 || rate <= 0)
+        return;
+
+    if (that->m_peak.size() != channels) {
+        that->m_peak.fill(0, channels);
+        that->m_sumSquares.fill(0, channels);
+        that->m_levelFrames = 0;
+    }
+
+    const float *samples = reinterpret_cast<const float *>(GST_BUFFER_DATA(buffer));
+    const int frames = GST_BUFFER_SIZE(buffer) / (channels * sizeof(float));
+    float *peak = that->m_peak.data();
+    float *sumSquares = that->m_sumSquares.data();
+    float *history = that->m_history.data();
+    const float scale = 1.0f / channels;
+    const int interval = qMax(1, rate / int(that->m_frameRate));
+
+    for (int i = 0; i < frames; ++i) {
+        float mix = 0;
+        for (int c = 0; c < channels; ++c) {
+            const float sample = samples[c];
+            peak[c] = qMax(peak[c], qAbs(sample));
+            sumSquares[c] += sample * sample;
+            mix += sample;
+        }
+        samples += channels;
+        history[that->m_historyPos] = mix * scale;
+        that->m_historyPos = (that->m_historyPos + 1) & (FFT_SIZE - 1);
+
+        if (++that->m_levelFrames >= interval)
+            that->analyze(rate);
+    }
+}
+
+static inline float toDecibel(float value)
+{
+    return 20.0f * log10f(qMax(value, MIN_LEVEL));
+}
+
+void Visualization::updateBandEdges(int sampleRate, int count)
+{
+    // Log spaced, but never narrower than one bin.
+    m_bandEdges.resize(count + 1);
+    const double nyquist = sampleRate / 2.0;
+    const double binWidth = double(sampleRate) / FFT_SIZE;
+    int previous = 0;
+    for (int i = 0; i <= count; ++i) {
+        const double frequency = LOWEST_BAND_HZ * pow(nyquist / LOWEST_BAND_HZ, double(i) / count);
+        int bin = qMin(int(frequency / binWidth), FFT_SIZE / 2);
+        if (i > 0)
+            bin = qMax(bin, previous + 1);
+        m_bandEdges[i] = qMin(bin, FFT_SIZE / 2);
+        previous = m_bandEdges[i];
+    }
+    m_edgesRate = sampleRate;
+}
+
+void Visualization::analyze(int sampleRate)
+{
+    const int channels = m_peak.size();
+    m_peakLevels.resize(channels);
+    m_rmsLevels.resize(channels);
+    float *peak = m_peakLevels.data();
+    float *rms = m_rmsLevels.data();
+    for (int c = 0; c < channels; ++c) {
+        peak[c] = toDecibel(m_peak[c]);
+        rms[c] = toDecibel(sqrtf(m_sumSquares[c] / m_levelFrames));
+        m_peak[c] = 0;
+        m_sumSquares[c] = 0;
+    }
+    m_levelFrames = 0;
+
+    // Unroll the history, oldest sample first.
+    const int tail = FFT_SIZE - m_historyPos;
+    qMemCopy(m_samples.data(), m_history.constData() + m_historyPos, tail * sizeof(float));
+    qMemCopy(m_samples.data() + tail, m_history.constData(), m_historyPos * sizeof(float));
+    m_fft.transform(m_samples.constData(), m_magnitudes.data());
+
+    // Even fewer bins lie above LOWEST_BAND_HZ below MIN_SAMPLE_RATE.
+    const int count = qMax(1, qMin<int>(m_bandCount, maxBands(sampleRate)));
+    if (m_edgesRate != sampleRate || m_bandEdges.size() != count + 1)
+        updateBandEdges(sampleRate, count);
+    m_bands.resize(count);
+    float *bands = m_bands.data();
+    const int *edges = m_bandEdges.constData();
+    const float *magnitudes = m_magnitudes.constData();
+    for (int band = 0; band < count; ++band) {
+        float level = 0;
+        for (int bin = edges[band]; bin < edges[band + 1]; ++bin)
+            level = qMax(level, magnitudes[bin]);
+        bands[band] = toDecibel(level);
+    }
+
+    emit levelsReady(m_peakLevels, m_rmsLevels);
+    emit spectrumReady(m_bands);
+}
+
+}
+}
+
+#include "moc_visualization.cpp"
@@ -0,0 +1,94 @@
+/*  This file is part of the KDE project.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 2.1 or 3 of the License.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef Phonon_GSTREAMER_VISUALIZATION_H
+#define Phonon_GSTREAMER_VISUALIZATION_H
+
+#include "fft.h"
+#include "medianode.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMetaType>
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+
+namespace Phonon
+{
+namespace Gstreamer
+{
+
+/**
+ * Audio sink that analyzes what it is fed on the streaming thread and only
+ * hands compact results to the frontend: the spectrum in bands and the
+ * peak/RMS level per channel, at most frameRate() times per second.
+ */
+class Visualization : public QObject, public MediaNode
+{
+    Q_OBJECT
+    Q_INTERFACES(Phonon::Gstreamer::MediaNode)
+
+public:
+    Visualization(Backend *backend, QObject *parent);
+    ~Visualization();
+
+    GstElement *audioElement() { return m_bin; }
+
+    /// callback function for handling new audio data
+    static void processBuffer(GstElement*, GstBuffer*, GstPad*, gpointer);
+
+public Q_SLOTS:
+    int bandCount() const;
+    void setBandCount(int count);
+    int frameRate() const;
+    void setFrameRate(int fps);
+
+signals:
+    // Level of each band in dBFS, log spaced from 20 Hz to half the rate
+    void spectrumReady(const QVector<float> &bands);
+    // Per channel, in dBFS, over everything since the previous emission
+    void levelsReady(const QVector<float> &peak, const QVector<float> &rms);
+
+private:
+    void analyze(int sampleRate);
+    void updateBandEdges(int sampleRate, int count);
+
+    GstElement *m_bin;
+    // Set from the frontend, read on the streaming thread
+    QAtomicInt m_bandCount;
+    QAtomicInt m_frameRate;
+
+    // Everything below is only touched from the streaming thread.
+    FFT m_fft;
+    // The last m_fft.size() samples of the mono mix, m_historyPos is the oldest
+    QVector<float> m_history;
+    int m_historyPos;
+    QVector<float> m_samples;
+    QVector<float> m_magnitudes;
+    QVector<float> m_peak;
+    QVector<float> m_sumSquares;
+    int m_levelFrames;
+    QVector<int> m_bandEdges;
+    int m_edgesRate;
+    // Emitted results, reused unless a receiver still holds the last ones
+    QVector<float> m_peakLevels;
+    QVector<float> m_rmsLevels;
+    QVector<float> m_bands;
+};
+
+}
+}
+
+Q_DECLARE_METATYPE(QVector<float>)
+
+#endif // Phonon_GSTREAMER_VISUALIZATION_H